@@ -6,104 +6,71 @@
  */
 
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
-#include <net/if.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <unistd.h>
 #include <stdbool.h>
-#include <unistd.h>
-                     
-#include <sys/ioctl.h>
-
-#include <netlink/genl/genl.h>
-#include <netlink/genl/family.h>
-#include <netlink/genl/ctrl.h>  
-#include <netlink/msg.h>
-#include <netlink/attr.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <sys/signalfd.h>
 
-#include "nl80211.h"
 #include "acs.h"
-
-#ifdef CONFIG_LIBNL1
-/* libnl 1.0 compatibility code */
-static inline struct nl_handle *nl_socket_alloc(void)
-{
-	return nl_handle_alloc();
-}
-
-static inline void nl_socket_free(struct nl_sock *h)
-{
-	nl_handle_destroy(h);
-}
-
-static inline int __genl_ctrl_alloc_cache(struct nl_sock *h, struct nl_cache **cache)
-{
-	struct nl_cache *tmp = genl_ctrl_alloc_cache(h);
-	if (!tmp)
-		return -ENOMEM;
-	*cache = tmp;
-	return 0;
-}
-#define genl_ctrl_alloc_cache __genl_ctrl_alloc_cache
-#endif /* CONFIG_LIBNL1 */
-
-int nl_debug = 0;
-
-static int nl80211_init(struct nl80211_state *state)
-{
-	int err;
-
-	state->nl_sock = nl_socket_alloc();
-	if (!state->nl_sock) {
-		fprintf(stderr, "Failed to allocate netlink socket.\n");
-		return -ENOMEM;
-	}
-
-	if (genl_connect(state->nl_sock)) {
-		fprintf(stderr, "Failed to connect to generic netlink.\n");
-		err = -ENOLINK;
-		goto out_handle_destroy;
-	}
-
-	if (genl_ctrl_alloc_cache(state->nl_sock, &state->nl_cache)) {
-		fprintf(stderr, "Failed to allocate generic netlink cache.\n");
-		err = -ENOMEM;
-		goto out_handle_destroy;
-	}
-
-	state->nl80211 = genl_ctrl_search_by_name(state->nl_cache, "nl80211");
-	if (!state->nl80211) {
-		fprintf(stderr, "nl80211 not found.\n");
-		err = -ENOENT;
-		goto out_cache_free;
-	}
-
-	return 0;
-
- out_cache_free:
-	nl_cache_free(state->nl_cache);
- out_handle_destroy:
-	nl_socket_free(state->nl_sock);
-	return err;
-}
-
-static void nl80211_cleanup(struct nl80211_state *state)
-{
-	genl_family_put(state->nl80211);
-	nl_cache_free(state->nl_cache);
-	nl_socket_free(state->nl_sock);
-}
+#include "acs_proto.h"
 
 static const char *argv0;
 
 static void usage(void)
 {
-        printf("Usage:\t%s <dev>\n", argv0);
+        printf("Usage:\t%s [options] <dev>\n", argv0);
+        printf("\t%s analyze [options] [<record> ...]\n", argv0);
+        printf("\t%s sweep [options] <record> ...\n", argv0);
+        printf("\t%s merge [options] <record|export> ...\n", argv0);
         printf("Options:\n");
-        printf("\t--debug\t\tenable netlink debugging\n");
+        printf("\t--debug\t\tenable netlink debugging and remain on channel traces\n");
+        printf("\t--record <file>\trecord all survey samples to this file\n");
+        printf("\t--index <file>\tadd the record to this index file\n");
+        printf("\t--export <file>\texport per-channel statistics to this file\n");
+        printf("\t--quick\trank channels on the counters the driver already has,\n");
+        printf("\t\t\twithout going off channel\n");
+        printf("\t--anytime\tprint the best channel so far after every round\n");
+        printf("\t--results <file>\tkeep the best channel so far in this file\n");
+        printf("\t--budget <ms>\tfinish the whole survey within this time\n");
+        printf("\t--daemon\tkeep surveying one round every interval\n");
+        printf("\t--interval <sec>\tseconds between daemon rounds, default 60\n");
+        printf("\t--window <n>\tsamples per channel kept by the daemon,\n");
+        printf("\t\t\tdefaults to --rounds\n");
+        printf("\t--fresh-ttl <sec>\tonly revisit channels in daemon rounds once their\n");
+        printf("\t\t\tsamples are this old, less for volatile channels\n");
+        printf("\t--cache-ttl <sec>\tanswer from results cached in " CACHE_DIR "\n");
+        printf("\t\t\tfor this long, default no cache\n");
+        printf("\t--cache-dir <dir>\tcache results here instead\n");
+        printf("\t--refresh\tsurvey even if cached results are fresh\n");
+        printf("\t--refresh-rounds <n>\tsurvey n rounds on top of cached results\n");
+        printf("\t--socket <file>\tanswer queries for the ranking on this Unix socket\n");
+        printf("\t--shm <name>\tpublish the ranking in this shared memory object\n");
+        printf("\t--in-use-hz <n>\tsample the operating channel n times a second\n");
+        printf("\t\t\twithout leaving it, and no longer dwell on it\n");
+        printf("\t--dwell <ms>\ttime to remain on each channel, default 60\n");
+        printf("\t--rounds <n>\tnumber of times to survey each channel, default 10\n");
+        printf("\t--adaptive\tpick the dwell time of each channel from its variance\n");
+        printf("\t\t\tand cut dwells short once the busy ratio settles\n");
+        printf("\t--min-dwell <ms>\tshortest adaptive dwell, default 20\n");
+        printf("\t--max-dwell <ms>\tlongest adaptive dwell, default 4 times --dwell\n");
+        printf("\t--confidence <c>\tstop once the best channel is known at this\n");
+        printf("\t\t\tconfidence level, e.g. 0.95, within at most --rounds\n");
+        printf("\t--snapshots <n>\ttake n survey snapshots, one per dwell time,\n");
+        printf("\t\t\tduring a single remain on channel, default 1\n");
+        printf("\t--profile-dir <dir>\tkeep driver profiles here, default " PROFILE_DIR "\n");
+        printf("\t--no-profile\tneither use nor keep a driver profile\n");
+        printf("\t--duty-cycle <pct>\tspend at most this percent of any duty\n");
+        printf("\t\t\twindow off channel, default no limit\n");
+        printf("\t--duty-window <ms>\twindow the duty cycle applies to, default 1000\n");
+        printf("\t--traffic-aware\tstart dwells in gaps of the station traffic\n");
+        printf("\t--noise-coeff <c>\tweight of the noise floor in the score, default 1\n");
+        printf("\t--rank <how>\trank channels by mean, p50, p95 or any pNN, default mean\n");
+        printf("\t--log2-clamp <n>\tclamp channel times to this before log2(), default 2^30\n");
 }
 
 static void version(void)
@@ -111,313 +78,352 @@ static void version(void)
 	printf("acs version %s\n", acs_version);
 }
 
-static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err,
-			 void *arg)
-{
-	int *ret = arg;
-	*ret = err->error;
-	return NL_STOP;
-}
-
-static int finish_handler(struct nl_msg *msg, void *arg)
-{
-	int *ret = arg;
-	*ret = 0;
-	return NL_SKIP;
-}
-
-static int ack_handler(struct nl_msg *msg, void *arg)
-{
-	int *ret = arg;
-	*ret = 0;
-	return NL_STOP;
-}
+/* Where answers to the survey go as they come in */
+struct answer_sink {
+	bool print;
+	const char *results_path;
+};
 
-static int wait_for_offchannel(struct nl80211_state *state,
-			       int devidx, int freq)
+static void report_answer(const struct acs_answer *answer, void *arg)
 {
-	int err;
-	static const __u32 cmds[] = {
-		NL80211_CMD_REMAIN_ON_CHANNEL,
-		NL80211_CMD_CANCEL_REMAIN_ON_CHANNEL,
-	};
-
-	err = wait_for_offchan_op(state, devidx, freq, ARRAY_SIZE(cmds), cmds);
-	if (err)
-		return err;
-
-	return 0;
-}
-
-static int call_survey_freq(struct nl80211_state *state, int devidx, int freq)
-{
-	struct nl_cb *cb;
-	struct nl_cb *s_cb;
-	struct nl_msg *msg;
-	int err;
-
-	msg = nlmsg_alloc();
-	if (!msg) {
-		fprintf(stderr, "failed to allocate netlink message\n");
-		return 2;
+	struct answer_sink *sink = arg;
+
+	if (sink->print) {
+		printf("%s answer after %u rounds: %d MHz, confidence %.2Lf%s%s\n",
+		       answer->final ? "final" : "provisional", answer->round,
+		       answer->freq, answer->confidence,
+		       answer->changed ? " (changed)" : "",
+		       answer->thin ? " (thin)" : "");
+		fflush(stdout);
 	}
 
-	cb = nl_cb_alloc(nl_debug ? NL_CB_DEBUG : NL_CB_DEFAULT);
-	s_cb = nl_cb_alloc(nl_debug ? NL_CB_DEBUG : NL_CB_DEFAULT);
-	if (!cb || !s_cb) {
-		fprintf(stderr, "failed to allocate netlink callbacks\n");
-		err = 2;
-		goto out_free_msg;
-	}
-
-	genlmsg_put(msg, 0, 0, genl_family_get_id(state->nl80211), 0,
-		    NLM_F_DUMP,
-		    NL80211_CMD_GET_SURVEY, 0);
-
-	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, devidx);
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, handle_survey_dump, (void *) &freq);
-	nl_socket_set_cb(state->nl_sock, s_cb);
-
-	err = nl_send_auto_complete(state->nl_sock, msg);
-	if (err < 0)
-		goto out;
-
-	err = 1;
-
-	nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &err);
-	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &err);
-	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &err);
-
-	while (err > 0)
-		nl_recvmsgs(state->nl_sock, cb);
- out:
-	nl_cb_put(cb);
- out_free_msg:
-	nlmsg_free(msg);
-	return err;
- nla_put_failure:
-	fprintf(stderr, "building message failed\n");
-	return 2;
+	if (sink->results_path && acs_answer_save(sink->results_path, answer))
+		fprintf(stderr, "failed to write results to %s\n",
+			sink->results_path);
 }
 
-static int go_offchan_freq(struct nl80211_state *state, int devidx, int freq)
-{
-	struct nl_cb *cb;
-	struct nl_cb *s_cb;
-	struct nl_msg *msg;
+/* What the client knows of the survey as it goes */
+struct client {
+	struct acs_session *session;
+	struct answer_sink sink;
+	struct service *service;
+	struct shm_pub *shm;
+	bool daemon;
+	bool debug;
+	bool over;
 	int err;
+};
 
-	msg = nlmsg_alloc();
-	if (!msg) {
-		fprintf(stderr, "failed to allocate netlink message\n");
-		return 2;
-	}
-
-	cb = nl_cb_alloc(nl_debug ? NL_CB_DEBUG : NL_CB_DEFAULT);
-	s_cb = nl_cb_alloc(nl_debug ? NL_CB_DEBUG : NL_CB_DEFAULT);
-	if (!cb || !s_cb) {
-		fprintf(stderr, "failed to allocate netlink callbacks\n");
-		err = 2;
-		goto out_free_msg;
-	}
-
-	genlmsg_put(msg, 0, 0, genl_family_get_id(state->nl80211), 0,
-		    0,
-		    NL80211_CMD_REMAIN_ON_CHANNEL, 0);
-
-	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, devidx);
-	NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, freq);
-	/* 5 seconds is the max allowed, values passed are in ms */
-	NLA_PUT_U32(msg, NL80211_ATTR_DURATION, 60);
-
-	nl_socket_set_cb(state->nl_sock, s_cb);
-
-	err = nl_send_auto_complete(state->nl_sock, msg);
-	if (err < 0)
-		goto out;
-
-	err = 1;
-
-	nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &err);
-	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &err);
-	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &err);
-
-	while (err > 0)
-		nl_recvmsgs(state->nl_sock, cb);
- out:
-	nl_cb_put(cb);
- out_free_msg:
-	nlmsg_free(msg);
-	return err;
- nla_put_failure:
-	fprintf(stderr, "building message failed\n");
-	return 2;
-}
-
-
-/*
- * Does a full survey on all channels. Since drivers will only
- * return survey data for channels they are allowed on we will
- * disregard further study on any channels we did not get any
- * survey data on.
- */
-static int get_freq_list(struct nl80211_state *state, int devidx)
+/* Errors and warnings go to stderr, the rest to stdout, debug only with --debug */
+static void client_log(int prio, const char *fmt, va_list ap, void *arg)
 {
-	int err;
+	struct client *client = arg;
+	FILE *fp = prio <= LOG_WARNING ? stderr : stdout;
 
-	err = call_survey_freq(state, devidx, 0);
-	if (err)
-		return err;
-	annotate_enabled_chans();
-	clear_freq_surveys();
+	if (prio == LOG_DEBUG && !client->debug)
+		return;
 
-	return 0;
+	vfprintf(fp, fmt, ap);
+	fputc('\n', fp);
+	fflush(fp);
 }
 
-/* Studies all frequencies known */
-static int study_freqs(struct nl80211_state *state, int devidx)
+static void survey_done(int err, void *arg)
 {
-	int err;
-	struct freq_item *freq;
-
-	err = nl80211_add_membership_mlme(state);
-	if (err)
-		return err;
+	struct client *client = arg;
 
-	dl_list_for_each(freq, &freq_list, struct freq_item, list_member) {
-		if (!freq->enabled)
-			continue;
-		err = go_offchan_freq(state, devidx, freq->center_freq);
-		if (err)
-			return err;
-		err = wait_for_offchannel(state, devidx, freq->center_freq);
-		if (err)
-			return err;
-		err = call_survey_freq(state, devidx, freq->center_freq);
-		if (err)
-			return err;
+	if (err) {
+		client->err = err;
+		client->over = true;
+		return;
 	}
 
-	return 0;
+	acs_session_report(client->session);
+	if (!client->daemon)
+		client->over = true;
 }
 
-static int get_ctl_fd(void)
+static void client_answer(const struct acs_answer *answer, void *arg)
 {
-	int fd;
-
-	fd = socket(PF_INET, SOCK_DGRAM, 0);
-	if (fd >= 0)
-		return fd;
-
-	fd = socket(PF_PACKET, SOCK_DGRAM, 0);
-	if (fd >= 0)
-		return fd;
-
-	fd = socket(PF_INET6, SOCK_DGRAM, 0);
-	if (fd >= 0)
-		return fd;
-
-	return -1;
+	struct client *client = arg;
+	struct acs_chan_info chans[ACS_PROTO_MAX_CHANS];
+	unsigned int nr;
+
+	report_answer(answer, &client->sink);
+	if (!client->service && !client->shm)
+		return;
+
+	nr = acs_session_ranking(client->session, chans, ACS_PROTO_MAX_CHANS);
+	if (client->service)
+		service_update(client->service, chans, nr, answer->round);
+	if (client->shm)
+		shm_publish(client->shm, chans, nr, answer->round);
 }
 
-
-static bool is_link_up(char *devname)
+/*
+ * Dispatches the session until the survey is over, or with a daemon
+ * until SIGINT or SIGTERM.
+ */
+static int run_session(struct client *client)
 {
-	struct ifreq ifr;
-	int fd;
+	struct signalfd_siginfo si;
+	struct pollfd pfd[3];
+	sigset_t mask;
 	int err;
 
-	strncpy(ifr.ifr_name, devname, IFNAMSIZ);
-	fd = get_ctl_fd();
-	if (fd < 0)
-		return false;
-	err = ioctl(fd, SIOCGIFFLAGS, &ifr);
-	if (err) {
-		close(fd);
-		return false;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	pfd[1].fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	if (pfd[1].fd < 0)
+		return -errno;
+	pfd[1].events = POLLIN;
+
+	pfd[0].fd = acs_session_fd(client->session);
+	pfd[0].events = POLLIN;
+	pfd[2].fd = client->service ? service_fd(client->service) : -1;
+	pfd[2].events = POLLIN;
+
+	while (!client->over) {
+		if (poll(pfd, 3, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			client->err = -errno;
+			break;
+		}
+		if ((pfd[1].revents & POLLIN) &&
+		    read(pfd[1].fd, &si, sizeof(si)) == sizeof(si))
+			break;
+		if (pfd[0].revents & POLLIN) {
+			err = acs_session_dispatch(client->session);
+			if (err)
+				client->err = err;
+		}
+		if (pfd[2].revents & POLLIN)
+			service_dispatch(client->service);
 	}
-	if (ifr.ifr_flags & IFF_UP)
-		return true;
 
-	return false;
+	close(pfd[1].fd);
+	return client->err;
 }
 
 int main(int argc, char **argv)
 {
-	struct nl80211_state nlstate;
-	int devidx = 0;
-	char *devname;
+	struct acs_config config;
+	struct acs_callbacks cb = {
+		.answer = client_answer,
+		.done = survey_done,
+		.log = client_log,
+	};
+	struct client client;
+	char *export_path = NULL, *socket_path = NULL, *shm_name = NULL;
+	bool quick = false;
+	unsigned int interval = 60, thin;
 	int err;
-	unsigned int surveys = 10;
 
         /* strip off self */
 	argc--;
 	argv0 = *argv++;
 
-	if (argc > 0 && strcmp(*argv, "--debug") == 0) {
-		nl_debug = 1;
+	if (argc > 0 && strcmp(*argv, "analyze") == 0)
+		return analyze_main(argc - 1, argv + 1);
+	if (argc > 0 && strcmp(*argv, "sweep") == 0)
+		return sweep_main(argc - 1, argv + 1);
+	if (argc > 0 && strcmp(*argv, "merge") == 0)
+		return merge_main(argc - 1, argv + 1);
+
+	acs_config_init(&config);
+	memset(&client, 0, sizeof(client));
+
+	while (argc > 0 && strncmp(*argv, "--", 2) == 0) {
+		if (strcmp(*argv, "--debug") == 0)
+			config.debug = true;
+		else if (strcmp(*argv, "--version") == 0) {
+			version();
+			return 0;
+		} else if (strcmp(*argv, "--record") == 0 && argc > 1) {
+			config.record_path = *++argv;
+			argc--;
+		} else if (strcmp(*argv, "--index") == 0 && argc > 1) {
+			config.index_path = *++argv;
+			argc--;
+		} else if (strcmp(*argv, "--export") == 0 && argc > 1) {
+			export_path = *++argv;
+			argc--;
+		} else if (strcmp(*argv, "--dwell") == 0 && argc > 1) {
+			config.params.dwell = strtoul(*++argv, NULL, 0);
+			argc--;
+		} else if (strcmp(*argv, "--rounds") == 0 && argc > 1) {
+			config.params.rounds = strtoul(*++argv, NULL, 0);
+			argc--;
+		} else if (strcmp(*argv, "--noise-coeff") == 0 && argc > 1) {
+			config.params.noise_coeff = strtold(*++argv, NULL);
+			argc--;
+		} else if (strcmp(*argv, "--adaptive") == 0) {
+			config.params.adaptive = true;
+		} else if (strcmp(*argv, "--min-dwell") == 0 && argc > 1) {
+			config.params.min_dwell = strtoul(*++argv, NULL, 0);
+			argc--;
+		} else if (strcmp(*argv, "--max-dwell") == 0 && argc > 1) {
+			config.params.max_dwell = strtoul(*++argv, NULL, 0);
+			argc--;
+		} else if (strcmp(*argv, "--confidence") == 0 && argc > 1) {
+			config.params.confidence = strtold(*++argv, NULL);
+			argc--;
+			if (config.params.confidence < 0 || config.params.confidence >= 1) {
+				usage();
+				return 1;
+			}
+		} else if (strcmp(*argv, "--snapshots") == 0 && argc > 1) {
+			config.params.snapshots = strtoul(*++argv, NULL, 0);
+			argc--;
+			if (!config.params.snapshots) {
+				usage();
+				return 1;
+			}
+		} else if (strcmp(*argv, "--profile-dir") == 0 && argc > 1) {
+			config.profile_dir = *++argv;
+			argc--;
+		} else if (strcmp(*argv, "--no-profile") == 0) {
+			config.profile_dir = NULL;
+		} else if (strcmp(*argv, "--duty-cycle") == 0 && argc > 1) {
+			config.params.duty_cycle = strtold(*++argv, NULL);
+			argc--;
+		} else if (strcmp(*argv, "--duty-window") == 0 && argc > 1) {
+			config.params.duty_window = strtoul(*++argv, NULL, 0);
+			argc--;
+		} else if (strcmp(*argv, "--traffic-aware") == 0) {
+			config.params.traffic_aware = true;
+		} else if (strcmp(*argv, "--quick") == 0) {
+			quick = true;
+		} else if (strcmp(*argv, "--anytime") == 0) {
+			client.sink.print = true;
+		} else if (strcmp(*argv, "--results") == 0 && argc > 1) {
+			client.sink.results_path = *++argv;
+			argc--;
+		} else if (strcmp(*argv, "--budget") == 0 && argc > 1) {
+			config.params.budget = strtoul(*++argv, NULL, 0);
+			argc--;
+		} else if (strcmp(*argv, "--daemon") == 0) {
+			client.daemon = true;
+		} else if (strcmp(*argv, "--interval") == 0 && argc > 1) {
+			interval = strtoul(*++argv, NULL, 0);
+			argc--;
+		} else if (strcmp(*argv, "--window") == 0 && argc > 1) {
+			config.window = strtoul(*++argv, NULL, 0);
+			argc--;
+		} else if (strcmp(*argv, "--fresh-ttl") == 0 && argc > 1) {
+			config.params.fresh_ttl = strtoul(*++argv, NULL, 0);
+			argc--;
+		} else if (strcmp(*argv, "--cache-ttl") == 0 && argc > 1) {
+			config.cache_ttl = strtoul(*++argv, NULL, 0);
+			argc--;
+		} else if (strcmp(*argv, "--cache-dir") == 0 && argc > 1) {
+			config.cache_dir = *++argv;
+			argc--;
+		} else if (strcmp(*argv, "--refresh") == 0) {
+			config.cache_refresh = true;
+		} else if (strcmp(*argv, "--refresh-rounds") == 0 && argc > 1) {
+			config.refresh_rounds = strtoul(*++argv, NULL, 0);
+			argc--;
+		} else if (strcmp(*argv, "--socket") == 0 && argc > 1) {
+			socket_path = *++argv;
+			argc--;
+		} else if (strcmp(*argv, "--shm") == 0 && argc > 1) {
+			shm_name = *++argv;
+			argc--;
+		} else if (strcmp(*argv, "--in-use-hz") == 0 && argc > 1) {
+			config.params.in_use_hz = strtoul(*++argv, NULL, 0);
+			argc--;
+		} else if (strcmp(*argv, "--rank") == 0 && argc > 1) {
+			argc--;
+			if (acs_parse_rank(*++argv, &config.params.rank_quantile)) {
+				usage();
+				return 1;
+			}
+		} else if (strcmp(*argv, "--log2-clamp") == 0 && argc > 1) {
+			config.params.log2_clamp = strtoull(*++argv, NULL, 0);
+			argc--;
+		} else {
+			usage();
+			return 1;
+		}
 		argc--;
 		argv++;
 	}
 
-	if (argc > 0 && strcmp(*argv, "--version") == 0) {
-		version();
-		return 0;
-	}
-
 	/* need to treat "help" command specially so it works w/o nl80211 */
 	if (argc == 0 || strcmp(*argv, "help") == 0) {
 		usage();
 		return 0;
 	}
 
-	err = nl80211_init(&nlstate);
-	if (err)
-		return 1;
-
-	if (argc <= 0) {
-		return 1;
+	config.ifname = *argv;
+	client.debug = config.debug;
+	if (client.daemon) {
+		client.sink.print = true;
+		config.interval = interval;
+		/* Without an interval there is nothing to do past the survey */
+		client.daemon = interval > 0;
 	}
-
-	devidx = if_nametoindex(*argv);
-	if (devidx == 0)
-		devidx = -1;
-
-	devname = *argv;
-	argc--;
-	argv++;
-
-	if (devidx < 0)
-		return -errno;
-
-	if (!is_link_up(devname)) {
-		err = -ENOLINK;
-		printf("Link for %s must be up to use acs\n", devname);
-		goto nl_cleanup;
-	}
-
 	/*
 	 * XXX: we should probably get channel list properly here
 	 * but I'm lazy. THIS IS A REQUIREMENT, given that if a device
 	 * is down and comes up we won't have any survey data to study.
 	 */
-	err = get_freq_list(&nlstate, devidx);
+	if (quick) {
+		config.profile_dir = NULL;
+		client.sink.print = true;
+	}
+
+	err = acs_session_open(&client.session, &config, &cb, &client);
+	if (err == -ENOLINK)
+		printf("Link for %s must be up to use acs\n", config.ifname);
 	if (err)
 		return err;
 
-	while (surveys--) {
-		err = study_freqs(&nlstate, devidx);
-		if (err)
-			return err;
+	if (quick) {
+		err = acs_session_quick(client.session, &thin);
+		if (!err)
+			acs_session_report(client.session);
+		goto out;
 	}
 
-	parse_freq_list();
-	parse_freq_int_factor();
+	if (socket_path) {
+		err = service_open(&client.service, socket_path);
+		if (err) {
+			fprintf(stderr, "failed to serve queries on %s: %s\n",
+				socket_path, strerror(-err));
+			goto out;
+		}
+	}
 
-nl_cleanup:
-	nl80211_cleanup(&nlstate);
-	clear_offchan_ops_list();
-	clean_freq_list();
+	if (shm_name) {
+		err = shm_pub_open(&client.shm, shm_name);
+		if (err) {
+			fprintf(stderr, "failed to publish in %s: %s\n",
+				shm_name, strerror(-err));
+			goto out;
+		}
+	}
 
+	err = acs_session_start(client.session);
+	if (err == -EOPNOTSUPP)
+		printf("%s does not report the noise floor and channel busy and "
+		       "transmit times in its survey, cannot survey it\n",
+		       config.ifname);
+	if (!err && !client.over)
+		err = run_session(&client);
+	if (!err)
+		err = client.err;
+
+	if (!err && export_path)
+		err = acs_session_export(client.session, export_path);
+
+ out:
+	shm_pub_close(client.shm);
+	service_close(client.service);
+	acs_session_close(client.session);
 	return err;
 }
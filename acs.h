@@ -2,6 +2,7 @@
 #define __ACS_H
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <netlink/netlink.h>
 #include <netlink/genl/genl.h>
 #include <netlink/genl/family.h>
@@ -9,22 +10,214 @@
 
 #include "nl80211.h"
 #include "list.h"
+#include "libacs.h"
 
 #define ETH_ALEN 6
 #define ARRAY_SIZE(ar) (sizeof(ar)/sizeof(ar[0]))
 #define DIV_ROUND_UP(x, y) (((x) + (y - 1)) / (y))
 #define BIT(x) (1ULL<<(x))
 
+/* Longest remain on channel duration nl80211 allows, in ms */
+#define ROC_MAX_DURATION	5000
+/* Times a channel is dwelled on again if its counters did not advance */
+#define STALE_MAX_RETRIES	2
+/* How long to wait for the kernel to start or end an offchannel operation */
+#define OFFCHAN_EVENT_TIMEOUT	1000
+/* Remain on channel operations of others remembered between two dispatches */
+#define FOREIGN_MAX		16
+/* Remain on channel operations of others tracked at once, a power of two */
+#define OFFCHAN_OPS_MAX		64
+/* Time in ms past its duration an operation of others is evicted after */
+#define OFFCHAN_OP_MAX_AGE	10000
+/* Survey time in ms a channel needs for a --quick ranking to be trusted */
+#define QUICK_MIN_CHANNEL_TIME	100
+/* Where driver profiles are kept unless told otherwise */
+#define PROFILE_DIR		"/var/cache/acs"
+/* Where survey results are cached unless told otherwise, gone on reboot */
+#define CACHE_DIR		"/run/acs"
+/* Survey attributes the interference factor cannot be computed without */
+#define SURVEY_ATTRS_REQUIRED	(BIT(NL80211_SURVEY_INFO_NOISE) | \
+				 BIT(NL80211_SURVEY_INFO_CHANNEL_TIME) | \
+				 BIT(NL80211_SURVEY_INFO_CHANNEL_TIME_BUSY) | \
+				 BIT(NL80211_SURVEY_INFO_CHANNEL_TIME_TX))
+/* Adaptive dwell bounds in ms, the upper one in multiples of --dwell */
+#define DWELL_MIN_DEFAULT	20
+#define DWELL_MAX_FACTOR	4
+/* Interval in ms the survey counters are looked at during adaptive dwells */
+#define DWELL_POLL_MS		10
+/* Dwells on a channel before its confidence interval is trusted */
+#define CONFIDENCE_MIN_DWELLS	3
+/* Overhead in ms assumed for a dwell until one has been timed */
+#define BUDGET_OVERHEAD_GUESS	15
+/* Shortest freshness TTL of the most volatile channels, as a fraction of --fresh-ttl */
+#define FRESH_MIN_FRACTION	8
+/* Busy ratio standard deviation at which a channel goes stale soonest */
+#define FRESH_FULL_STDDEV	0.1L
+/* Confidence a new best channel needs to replace the one published */
+#define ANSWER_SWITCH_CONFIDENCE	0.9L
+/* Station traffic polling while waiting for an idle gap, in ms */
+#define TRAFFIC_POLL_MS		20
+#define TRAFFIC_MAX_WAIT	500
+/* Bytes per poll below which the stations are considered idle */
+#define TRAFFIC_IDLE_BYTES	1500
+
 #ifdef CONFIG_LIBNL1
 #  define nl_sock nl_handle
 #endif
 
-extern struct dl_list freq_list;
+struct in_use_sampler;
+struct offchan_dwell;
+
+/**
+ * struct offchan_op - remain on channel operation of another application
+ *
+ * @wdev: wireless device it was requested on, its interface index if the
+ *	event carried no wireless device, 0 for a free slot
+ * @freq: channel it remains on, in MHz
+ * @duration: time in ms it was requested for
+ * @cookie: what the kernel identifies it by
+ * @start: CLOCK_MONOTONIC time in ms it started at
+ */
+struct offchan_op {
+	__u64 wdev;
+	int freq;
+	__u32 duration;
+	__u64 cookie;
+	__u64 start;
+};
+
+/**
+ * struct acs_logger - where the messages of a session go
+ *
+ * @fn: if set called with every message, else they are dropped
+ * @arg: passed on to @fn
+ */
+struct acs_logger {
+	log_fn fn;
+	void *arg;
+};
 
+void acs_log(const struct acs_logger *log, int prio, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+/**
+ * struct nl80211_state - netlink session of one survey session
+ *
+ * @nl_sock: socket requests are sent and answered on
+ * @ev_sock: non-blocking socket the mlme and scan multicast events come
+ *	in on
+ * @nl_cache: generic netlink families known
+ * @nl80211: the nl80211 family
+ * @debug: whether netlink messages are dumped as they go by
+ * @in_use: if set sampler of the operating channel
+ * @dwell: our remain on channel operation in flight, if any
+ * @wiphy: index of the wiphy surveyed, events of other wiphys are ignored
+ * @offchan_ops: offchannel operations of other applications in flight,
+ *	an open addressing table keyed by wireless device and cookie
+ * @nr_offchan_ops: number of operations in @offchan_ops
+ * @scanned: a scan of someone else's completed since last cleared
+ * @foreign: channels other applications remained on and left since last
+ *	cleared
+ * @nr_foreign: number of channels in @foreign
+ * @event_time: CLOCK_MONOTONIC time in ms the event being processed was
+ *	read at
+ * @log: where messages about events go
+ */
 struct nl80211_state {
 	struct nl_sock *nl_sock;
+	struct nl_sock *ev_sock;
 	struct nl_cache *nl_cache;
 	struct genl_family *nl80211;
+	bool debug;
+	struct in_use_sampler *in_use;
+	struct offchan_dwell *dwell;
+	__u32 wiphy;
+	struct offchan_op offchan_ops[OFFCHAN_OPS_MAX];
+	unsigned int nr_offchan_ops;
+	bool scanned;
+	__u16 foreign[FOREIGN_MAX];
+	unsigned int nr_foreign;
+	__u64 event_time;
+	struct acs_logger log;
+};
+
+/**
+ * struct chan_stats - mergeable statistics of a channel
+ *
+ * @count: number of values seen
+ * @mean: mean of the values seen
+ * @m2: sum of the squared differences of the values from the mean
+ * @min: smallest value seen
+ * @max: largest value seen
+ * @first: timestamp of the oldest value, in ms since the epoch
+ * @last: timestamp of the newest value, in ms since the epoch
+ */
+struct chan_stats {
+	__u64 count;
+	long double mean;
+	long double m2;
+	long double min;
+	long double max;
+	__u64 first;
+	__u64 last;
+};
+
+struct stats_table_entry {
+	__u16 freq;
+	struct chan_stats stats;
+};
+
+/* Per-channel statistics of a whole run, site or fleet */
+struct stats_table {
+	unsigned int nr;
+	struct stats_table_entry *entries;
+};
+
+#define SKETCH_MAX_BINS		256
+#define BUSY_SKETCH_BINS	200
+
+/**
+ * struct quantile_sketch - fixed-size histogram for quantile estimates
+ *
+ * @lo: lower bound of the first bin
+ * @width: width of each bin
+ * @nr_bins: number of bins in use, values outside are put in the edge bins
+ * @count: number of values added
+ * @bins: number of values that fell in each bin
+ */
+struct quantile_sketch {
+	long double lo;
+	long double width;
+	unsigned int nr_bins;
+	__u64 count;
+	__u32 bins[SKETCH_MAX_BINS];
+};
+
+enum counter_mode {
+	COUNTERS_UNKNOWN,
+	COUNTERS_CUMULATIVE,
+	COUNTERS_RESET,
+};
+
+/**
+ * struct survey_snapshot - raw survey counters last reported for a channel
+ *
+ * @valid: whether a snapshot has been taken yet
+ * @mono: CLOCK_MONOTONIC time in ms the snapshot was taken at
+ * @dwell_seq: dwell on the channel the snapshot was taken during
+ * @channel_time: raw active time counter
+ * @channel_time_busy: raw busy time counter
+ * @channel_time_rx: raw receive time counter
+ * @channel_time_tx: raw transmit time counter
+ */
+struct survey_snapshot {
+	bool valid;
+	__u64 mono;
+	unsigned int dwell_seq;
+	__u64 channel_time;
+	__u64 channel_time_busy;
+	__u64 channel_time_rx;
+	__u64 channel_time_tx;
 };
 
 struct freq_item {
@@ -34,27 +227,426 @@ struct freq_item {
 	__s8 min_noise;
 	/* An alternative is to use __float128 for low noise environments */
 	long double interference_factor;
+	struct chan_stats stats;
+	struct quantile_sketch busy_sketch;
+	struct quantile_sketch noise_sketch;
+	/* busy ratio of each dwell, drives how long the next dwell is */
+	struct chan_stats busy_stats;
+	/* interference factor of each dwell against a noise floor of 0 dBm */
+	struct chan_stats live_stats;
+	/* no longer surveyed, another channel is better with confidence */
+	bool dominated;
+	/* the operating channel, as flagged by the last survey dump */
+	bool in_use;
+	struct survey_snapshot snapshot;
+	unsigned int dwell_seq;
+	bool stale;
 	struct dl_list list_member;
 	unsigned int survey_count;
 	struct dl_list survey_list;
 };
 
+/**
+ * struct survey_sample - one raw survey reading for a frequency
+ *
+ * @timestamp: wall clock time the sample was taken, in ms since the epoch
+ * @center_freq: center of frequency for the surveyed channel
+ * @noise: channel noise in dBm
+ * @channel_time: amount of time in ms the radio spent on the channel
+ * @channel_time_busy: amount of time in ms the channel was found busy
+ * @channel_time_rx: amount of time the radio spent receiving data
+ * @channel_time_tx: amount of time the radio spent transmitting data
+ */
+struct survey_sample {
+	__u64 timestamp;
+	__u16 center_freq;
+	__s8 noise;
+	__u64 channel_time;
+	__u64 channel_time_busy;
+	__u64 channel_time_rx;
+	__u64 channel_time_tx;
+};
+
+struct sample_record;
+struct driver_profile;
+
+/* One interval spent off channel, in CLOCK_MONOTONIC ms */
+struct airtime_span {
+	__u64 start;
+	__u64 end;
+};
+
+/**
+ * struct airtime - account of the time spent off channel
+ *
+ * @window: length in ms of the window the duty cycle applies to
+ * @budget: most ms to spend off channel within any @window, 0 for no limit
+ * @since: CLOCK_MONOTONIC time in ms accounting started at
+ * @total: ms spent off channel since @since
+ * @nr: number of intervals in @ledger
+ * @size: number of intervals @ledger has room for
+ * @ledger: with a @budget, the off channel intervals that ended within
+ *	the last @window, oldest first
+ */
+struct airtime {
+	unsigned int window;
+	unsigned int budget;
+	__u64 since;
+	__u64 total;
+	unsigned int nr;
+	unsigned int size;
+	struct airtime_span *ledger;
+};
+
+#define RETUNE_MAX_FREQS	128
+
+/**
+ * struct retune_matrix - learned cost of moving the radio between channels
+ *
+ * @nr: number of frequencies in @freqs
+ * @freqs: frequency each row and column of @cost stands for
+ * @cost: smoothed latency in ms from asking to remain on the column's
+ *	channel while on the row's one until being there, negative if
+ *	never measured
+ * @last_freq: channel the radio was last sent to, 0 if none yet, where
+ *	it still is if there is no operating channel
+ * @round: number of rounds planned so far
+ */
+struct retune_matrix {
+	unsigned int nr;
+	__u16 freqs[RETUNE_MAX_FREQS];
+	long double cost[RETUNE_MAX_FREQS][RETUNE_MAX_FREQS];
+	__u16 last_freq;
+	unsigned int round;
+};
+
+/**
+ * struct acs_ctx - survey state for one device or one recorded sample file
+ *
+ * Everything the scoring code needs lives here rather than in globals so
+ * that several recorded sample files can be scored in parallel.
+ *
+ * @freq_list: list of struct freq_item, one per frequency seen
+ * @lowest_noise: lowest noise floor observed across all frequencies
+ * @params: scoring and sampling parameters in use
+ * @counter_mode: how the driver was found to keep its survey counters
+ * @record: if set every sample added is also appended to this record
+ * @max_roc_duration: longest remain on channel duration the wiphy allows
+ * @retune: if set channels are visited in the order cheapest to retune in
+ * @survey_attrs: mask of the NL80211_SURVEY_INFO_* attributes seen
+ * @profile: if set the profile of the driver, refined as we go
+ * @airtime: time spent off channel
+ * @answer: last answer published
+ * @on_answer: if set called with every answer published
+ * @on_answer_arg: passed on to @on_answer
+ * @log: where messages about the survey go
+ * @deadline: CLOCK_MONOTONIC time in ms the survey has to be over by
+ * @round_dwell: if non zero longest dwell the time left allows this round
+ * @overhead: ms each dwell took on top of the time spent on channel
+ */
+struct acs_ctx {
+	struct dl_list freq_list;
+	__s8 lowest_noise;
+	struct acs_params params;
+	enum counter_mode counter_mode;
+	struct sample_record *record;
+	unsigned int max_roc_duration;
+	struct retune_matrix *retune;
+	__u32 survey_attrs;
+	struct driver_profile *profile;
+	struct airtime airtime;
+	struct acs_answer answer;
+	answer_fn on_answer;
+	void *on_answer_arg;
+	struct acs_logger log;
+	__u64 deadline;
+	unsigned int round_dwell;
+	struct chan_stats overhead;
+};
+
+/*
+ * Argument passed to handle_survey_dump(), if @peek is set the raw entry
+ * for @freq is copied there and nothing is added to the survey. If
+ * @in_use is set only the entry of the operating channel is added.
+ */
+struct survey_req {
+	struct acs_ctx *ctx;
+	int freq;
+	struct survey_sample *peek;
+	bool in_use;
+};
+
+/**
+ * struct in_use_sampler - sampler of the operating channel
+ *
+ * The operating channel can be surveyed without leaving it, so it is
+ * sampled often with one request built once and sent again every time.
+ *
+ * @msg: the survey dump request
+ * @cb: callbacks its replies are processed with
+ * @req: where its replies go
+ * @err: status of the request in flight
+ * @period: ms between samples
+ * @last: CLOCK_MONOTONIC time in ms of the last sample
+ */
+struct in_use_sampler {
+	struct nl_msg *msg;
+	struct nl_cb *cb;
+	struct survey_req req;
+	int err;
+	unsigned int period;
+	__u64 last;
+};
+
+long double interference_factor(const struct acs_params *params,
+				const struct survey_sample *sample,
+				__s8 min_noise);
+void acs_ctx_init(struct acs_ctx *ctx);
 int handle_survey_dump(struct nl_msg *msg, void *arg);
-void parse_freq_list(void);
-void parse_freq_int_factor(void);
-void annotate_enabled_chans(void);
-void clean_freq_list(void);
-void clear_freq_surveys(void);
-__u32 wait_for_offchan_op(struct nl80211_state *state,
-			  int devidx, int freq,
-			  const int n_waits, const __u32 *waits);
-void clear_offchan_ops_list(void);
+long double survey_busy_ratio(const struct survey_sample *sample);
+int add_survey_sample(struct acs_ctx *ctx, __u32 ifidx,
+		      const struct survey_sample *sample);
+void score_freq_list(struct acs_ctx *ctx);
+long double freq_rank_factor(struct acs_ctx *ctx, struct freq_item *freq);
+struct freq_item *get_ideal_freq(struct acs_ctx *ctx);
+struct freq_item *find_freq_item(struct acs_ctx *ctx, __u16 center_freq);
+void parse_freq_list(struct acs_ctx *ctx);
+void parse_freq_int_factor(struct acs_ctx *ctx);
+unsigned int count_thin_freqs(struct acs_ctx *ctx, __u64 min_time);
+void annotate_enabled_chans(struct acs_ctx *ctx);
+void clean_freq_list(struct acs_ctx *ctx);
+void clear_freq_surveys(struct acs_ctx *ctx);
+void trim_freq_surveys(struct acs_ctx *ctx, unsigned int keep);
+void record_freq_surveys(struct acs_ctx *ctx, struct sample_record *rec);
+
+struct sample_record *record_open(const char *path, unsigned int dwell);
+void record_sample(struct sample_record *rec, const struct survey_sample *sample);
+int record_close(struct sample_record *rec, const char *index_path);
+typedef int (*record_fn)(const struct survey_sample *sample, void *arg);
+int record_for_each(const char *path, __u64 from, __u64 to,
+		    unsigned int *dwell, record_fn fn, void *arg);
+int record_load(struct acs_ctx *ctx, const char *path, __u64 from, __u64 to);
+__u64 wall_clock_ms(void);
+
+void chan_stats_init(struct chan_stats *stats);
+void chan_stats_add(struct chan_stats *stats, long double value, __u64 timestamp);
+void chan_stats_merge(struct chan_stats *dst, const struct chan_stats *src);
+long double chan_stats_variance(const struct chan_stats *stats);
+long double chan_stats_stddev(const struct chan_stats *stats);
+struct chan_stats *stats_table_get(struct stats_table *table, __u16 freq);
+int stats_table_merge(struct stats_table *dst, const struct stats_table *src);
+int stats_table_from_ctx(struct stats_table *table, struct acs_ctx *ctx);
+void stats_table_free(struct stats_table *table);
+void stats_table_write(FILE *fp, struct stats_table *table);
+int stats_table_export(const char *path, struct stats_table *table);
+int stats_table_read(struct stats_table *table, const char *path);
+bool stats_file_is_export(const char *path);
+
+__u64 monotonic_ms(void);
+const char *counter_mode_name(enum counter_mode mode);
+void survey_dwell_start(struct freq_item *freq);
+enum survey_delta_ret {
+	SURVEY_DELTA_BASELINE,
+	SURVEY_DELTA_FRESH,
+	SURVEY_DELTA_STALE,
+};
+
+enum survey_delta_ret survey_delta(struct acs_ctx *ctx, struct freq_item *freq,
+				   struct survey_sample *sample);
+enum survey_delta_ret survey_peek_delta(struct acs_ctx *ctx,
+					struct freq_item *freq,
+					struct survey_sample *sample);
+
+/**
+ * struct dwell_watch - state kept while watching an adaptive dwell
+ *
+ * @min_dwell: time in ms the dwell lasts at least
+ * @last_ratio: busy ratio seen on the previous look, negative if none yet
+ */
+struct dwell_watch {
+	unsigned int min_dwell;
+	long double last_ratio;
+};
+
+unsigned int freq_dwell(struct acs_ctx *ctx, struct freq_item *freq);
+void dwell_watch_init(struct dwell_watch *watch, struct acs_ctx *ctx);
+int dwell_watch_next(struct dwell_watch *watch, __u64 elapsed);
+bool dwell_watch_converged(struct dwell_watch *watch,
+			   const struct survey_sample *peek);
+long double normal_cdf(long double x);
+long double confidence_z(long double level);
+long double confidence_t(long double level, unsigned int df);
+bool freq_score_bounds(struct acs_ctx *ctx, struct freq_item *freq,
+		       long double *lo, long double *hi);
+unsigned int prune_dominated(struct acs_ctx *ctx);
+unsigned int count_active_freqs(struct acs_ctx *ctx);
+unsigned int budget_round_dwell(struct acs_ctx *ctx, unsigned int nr,
+				unsigned int rounds_left);
+bool budget_allows(struct acs_ctx *ctx, unsigned int duration);
+void budget_account(struct acs_ctx *ctx, unsigned int duration, __u64 elapsed);
+__u64 freq_ttl(struct acs_ctx *ctx, struct freq_item *freq);
+unsigned int plan_stale(struct acs_ctx *ctx, struct freq_item **order,
+			unsigned int max);
+
+void publish_answer(struct acs_ctx *ctx, unsigned int round, bool final);
+unsigned int ranking_build(struct acs_ctx *ctx, struct acs_chan_info *chans,
+			   unsigned int max);
+
+int airtime_init(struct airtime *air, long double duty_cycle,
+		 unsigned int window, unsigned int min_dwell);
+void airtime_free(struct airtime *air);
+unsigned int airtime_wait(struct airtime *air, unsigned int *duration);
+void airtime_account(struct airtime *air, __u64 start, __u64 end);
+void airtime_report(struct airtime *air, const struct acs_logger *log);
+
+/* Argument passed to handle_station_dump() */
+struct station_traffic {
+	unsigned int stations;
+	__u32 bytes;
+};
+
+int handle_station_dump(struct nl_msg *msg, void *arg);
+
+/* What the survey results of a device are cached under */
+struct wiphy_id {
+	char name[32];
+	char alpha2[3];
+};
+
+struct retune_matrix *retune_alloc(void);
+void retune_free(struct retune_matrix *m);
+void retune_observe(struct retune_matrix *m, __u16 from, __u16 to,
+		    __u64 latency);
+long double retune_cost(struct retune_matrix *m, __u16 from, __u16 to);
+__u16 retune_home(struct acs_ctx *ctx);
+unsigned int plan_round(struct acs_ctx *ctx, struct freq_item **order,
+			unsigned int max);
+
+void sketch_init(struct quantile_sketch *sketch, long double lo, long double hi,
+		 unsigned int nr_bins);
+void sketch_reset(struct quantile_sketch *sketch);
+void sketch_add(struct quantile_sketch *sketch, long double value);
+void sketch_merge(struct quantile_sketch *dst, const struct quantile_sketch *src);
+long double sketch_quantile(const struct quantile_sketch *sketch, long double q);
+
+typedef void (*pool_fn)(unsigned int task, void *arg);
+int pool_run(unsigned int nr_tasks, unsigned int nr_workers,
+	     pool_fn fn, void *arg);
+unsigned int pool_default_workers(void);
+
+int analyze_main(int argc, char **argv);
+int sweep_main(int argc, char **argv);
+int merge_main(int argc, char **argv);
+
+/**
+ * struct offchan_dwell - one remain on channel operation of ours
+ *
+ * @ifidx: interface the operation was requested on
+ * @freq: frequency remained on
+ * @duration: duration requested in ms
+ * @cookie: cookie the kernel assigned to the operation
+ * @started: whether the kernel reported the radio is now on @freq
+ * @ended: whether the kernel reported the operation is over
+ * @requested: CLOCK_MONOTONIC time in ms the operation was requested at
+ * @start: CLOCK_MONOTONIC time in ms the operation started at
+ * @end: CLOCK_MONOTONIC time in ms the operation ended at
+ * @cancelled: whether we ended the operation before its time
+ */
+struct offchan_dwell {
+	int ifidx;
+	int freq;
+	unsigned int duration;
+	__u64 cookie;
+	bool started;
+	bool ended;
+	__u64 requested;
+	__u64 start;
+	__u64 end;
+	bool cancelled;
+};
+
+void offchan_process(struct nl80211_state *state);
+void clear_offchan_ops(struct nl80211_state *state);
+
+int nl80211_init(struct nl80211_state *state, bool debug);
+void nl80211_cleanup(struct nl80211_state *state);
+int call_survey_freq(struct nl80211_state *state, struct acs_ctx *ctx,
+		     int devidx, int freq);
+int peek_survey_freq(struct nl80211_state *state, struct acs_ctx *ctx,
+		     int devidx, int freq, struct survey_sample *peek);
+int in_use_sampler_init(struct nl80211_state *state, struct acs_ctx *ctx,
+			int devidx, struct in_use_sampler *sampler);
+void in_use_sampler_free(struct nl80211_state *state);
+int sample_in_use(struct nl80211_state *state);
+int go_offchan_freq(struct nl80211_state *state, struct offchan_dwell *dwell);
+int cancel_offchan(struct nl80211_state *state, struct offchan_dwell *dwell);
+int get_wiphy_info(struct nl80211_state *state, struct acs_ctx *ctx,
+		   int devidx);
+int get_freq_list(struct nl80211_state *state, struct acs_ctx *ctx,
+		  int devidx);
+int get_station_traffic(struct nl80211_state *state, int devidx,
+			struct station_traffic *traffic);
+int get_wiphy_id(struct nl80211_state *state, int devidx, struct wiphy_id *id);
+int get_wiphy_index(struct nl80211_state *state, int devidx);
+
+int cache_path(char *path, size_t len, const char *dir,
+	       const struct wiphy_id *id, struct acs_ctx *ctx);
+int cache_load(struct acs_ctx *ctx, const char *path, unsigned int ttl);
+int cache_save(struct acs_ctx *ctx, const char *path);
+
+/**
+ * struct driver_profile - what is known about a driver and its firmware
+ *
+ * @path: file the profile is kept in
+ * @loaded: whether the profile was read from @path
+ * @counter_mode: how the driver keeps its survey counters
+ * @max_roc_duration: longest remain on channel duration allowed, in ms
+ * @roc_start: ms from requesting a remain on channel to it starting
+ * @roc_stop: ms a remain on channel ended past its requested end
+ * @dwell_ratio: time spent on channel over the duration requested
+ */
+struct driver_profile {
+	char path[512];
+	bool loaded;
+	enum counter_mode counter_mode;
+	unsigned int max_roc_duration;
+	struct chan_stats roc_start;
+	struct chan_stats roc_stop;
+	struct chan_stats dwell_ratio;
+};
+
+int profile_init(struct driver_profile *prof, const char *dir,
+		 const char *driver, const char *fw_version);
+int profile_load(struct driver_profile *prof);
+int profile_save(struct driver_profile *prof);
+void profile_apply(struct driver_profile *prof, struct acs_ctx *ctx);
+void profile_observe_dwell(struct driver_profile *prof,
+			   const struct offchan_dwell *dwell);
+void profile_update(struct driver_profile *prof, struct acs_ctx *ctx);
+unsigned int profile_dwell(const struct driver_profile *prof,
+			   unsigned int duration);
+
+struct service;
+
+int service_open(struct service **service, const char *path);
+void service_close(struct service *svc);
+int service_fd(struct service *svc);
+void service_dispatch(struct service *svc);
+void service_update(struct service *svc, const struct acs_chan_info *chans,
+		    unsigned int nr, unsigned int round);
+
+struct shm_pub;
+
+int shm_pub_open(struct shm_pub **pub, const char *name);
+void shm_pub_close(struct shm_pub *pub);
+void shm_publish(struct shm_pub *pub, const struct acs_chan_info *chans,
+		 unsigned int nr, unsigned int round);
 
 int nl_get_multicast_id(struct nl_sock *sock, const char *family, const char *group);
 
 int nl80211_add_membership_mlme(struct nl80211_state *state);
+int nl80211_add_membership_scan(struct nl80211_state *state);
 
 extern const char acs_version[];
-extern int nl_debug;
 
 #endif /* __ACS_H */
@@ -0,0 +1,211 @@
+#ifndef __ACS_PROTO_H
+#define __ACS_PROTO_H
+
+/*
+ * acs query protocol
+ *
+ * acs --socket serves the rankings it keeps in memory on a SOCK_SEQPACKET
+ * Unix socket, so local components can ask for the best channel without
+ * surveying on their own. Every request and every reply is one packet: a
+ * struct acs_msg header followed by @len bytes of payload. Replies carry
+ * the @seq of their request. Fields are in host byte order, the socket
+ * never leaves the host.
+ *
+ * A subscribed client is sent an ACS_MSG_RANKING with @seq 0 every time
+ * the order of the channels changes. A subscriber that does not read its
+ * updates is disconnected once its socket is full.
+ */
+
+#include <linux/types.h>
+
+#define ACS_PROTO_VERSION	1
+/* Most channels in a ranking */
+#define ACS_PROTO_MAX_CHANS	128
+
+enum acs_msg_type {
+	/* requests */
+	ACS_MSG_BEST_REQ = 1,		/* struct acs_best_req */
+	ACS_MSG_RANKING_REQ,		/* no payload */
+	ACS_MSG_STATS_REQ,		/* struct acs_stats_req */
+	ACS_MSG_SUBSCRIBE,		/* no payload */
+	ACS_MSG_UNSUBSCRIBE,		/* no payload */
+
+	/* replies and updates */
+	ACS_MSG_BEST = 64,		/* struct acs_best */
+	ACS_MSG_RANKING,		/* struct acs_ranking */
+	ACS_MSG_STATS,			/* struct acs_chan_info */
+	ACS_MSG_ACK,			/* no payload */
+	ACS_MSG_ERROR,			/* struct acs_error */
+};
+
+enum acs_band {
+	ACS_BAND_2GHZ,
+	ACS_BAND_5GHZ,
+	ACS_BAND_6GHZ,
+};
+
+struct acs_msg {
+	__u16 type;
+	__u16 len;
+	__u32 seq;
+};
+
+/*
+ * Best channel of @band for a @width MHz wide operation, @width is one of
+ * 20, 40, 80 and 160. In the 2.4 GHz band a 40 MHz block is any channel
+ * with the one 20 MHz up, channels 1+5 to 9+13 from 2412 MHz, and wider
+ * operations are rejected with -EINVAL.
+ */
+struct acs_best_req {
+	__u16 band;
+	__u16 width;
+};
+
+struct acs_stats_req {
+	__u16 freq;
+	__u16 pad;
+};
+
+#define ACS_CHAN_IN_USE		(1 << 0)
+#define ACS_CHAN_DOMINATED	(1 << 1)
+
+/**
+ * struct acs_chan_info - what is known about one channel
+ *
+ * @freq: center frequency of the 20 MHz channel, in MHz
+ * @flags: ACS_CHAN_* flags
+ * @min_noise: lowest noise floor seen, in dBm
+ * @max_noise: highest noise floor seen, in dBm
+ * @samples: survey samples kept
+ * @factor: interference factor channels are ranked by, lower is better,
+ *	in thousandths
+ * @mean: mean interference factor of a dwell against a 0 dBm noise
+ *	floor, in thousandths
+ * @stddev: its standard deviation, in thousandths
+ * @busy_p50: median busy ratio, in ten thousandths
+ * @busy_p95: 95th percentile of the busy ratio, in ten thousandths
+ */
+struct acs_chan_info {
+	__u16 freq;
+	__u8 flags;
+	__s8 min_noise;
+	__s8 max_noise;
+	__u8 pad[3];
+	__u32 samples;
+	__s32 factor;
+	__s32 mean;
+	__u32 stddev;
+	__u16 busy_p50;
+	__u16 busy_p95;
+};
+
+/**
+ * struct acs_ranking - channels best first
+ *
+ * @generation: bumped every time the order of the channels changes
+ * @round: rounds surveyed
+ * @nr: number of entries in @chans
+ * @chans: the channels
+ */
+struct acs_ranking {
+	__u32 generation;
+	__u32 round;
+	__u16 nr;
+	__u16 pad;
+	struct acs_chan_info chans[];
+};
+
+/**
+ * struct acs_best - best channel for an operation
+ *
+ * @freq: primary 20 MHz channel, in MHz
+ * @center: center frequency of the whole operation, in MHz
+ * @width: width of the operation, in MHz
+ * @factor: mean interference factor of the channels it spans, in
+ *	thousandths
+ * @generation: generation of the ranking the answer comes from
+ */
+struct acs_best {
+	__u16 freq;
+	__u16 center;
+	__u16 width;
+	__u16 pad;
+	__s32 factor;
+	__u32 generation;
+};
+
+/* @error is a negative errno, -ENOENT if there is no such channel */
+struct acs_error {
+	__s32 error;
+};
+
+/*
+ * Shared memory publication
+ *
+ * acs --shm keeps the latest ranking in a POSIX shared memory object for
+ * readers that look at it too often for a socket round trip. The writer
+ * makes @seq odd before it touches the ranking and even again once it is
+ * done, so a reader copies the ranking out between two reads of an even
+ * @seq that agree, and tries again otherwise. Readers never write to the
+ * object and the writer never waits for them.
+ */
+
+#define ACS_SHM_MAGIC		0x41435353	/* "ACSS" */
+/* Reads of a ranking being rewritten before acs_shm_read() gives up */
+#define ACS_SHM_MAX_TRIES	100000
+
+/* What struct acs_ranking holds besides its channels */
+struct acs_ranking_hdr {
+	__u32 generation;
+	__u32 round;
+	__u16 nr;
+	__u16 pad;
+};
+
+struct acs_shm {
+	__u32 magic;
+	__u32 version;
+	__u32 seq;
+	__u32 pad;
+	struct acs_ranking_hdr ranking;
+	struct acs_chan_info chans[ACS_PROTO_MAX_CHANS];
+};
+
+/*
+ * Copies a consistent snapshot of the ranking in @shm to @ranking, which
+ * has room for ACS_PROTO_MAX_CHANS channels. Returns -1 if @shm holds no
+ * ranking of this version of the protocol, and 1 if every one of
+ * ACS_SHM_MAX_TRIES reads raced with the writer, as happens for good if
+ * it died halfway through an update.
+ */
+static inline int acs_shm_read(const struct acs_shm *shm,
+			       struct acs_ranking *ranking)
+{
+	__u32 seq, nr = 0, tries = 0;
+
+	if (shm->magic != ACS_SHM_MAGIC || shm->version != ACS_PROTO_VERSION)
+		return -1;
+
+	do {
+		if (tries++ == ACS_SHM_MAX_TRIES)
+			return 1;
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		ranking->generation = shm->ranking.generation;
+		ranking->round = shm->ranking.round;
+		ranking->nr = shm->ranking.nr;
+		ranking->pad = 0;
+		nr = ranking->nr < ACS_PROTO_MAX_CHANS ?
+			ranking->nr : ACS_PROTO_MAX_CHANS;
+		__builtin_memcpy(ranking->chans, shm->chans,
+				 nr * sizeof(shm->chans[0]));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) ||
+		 __atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq);
+
+	ranking->nr = nr;
+	return 0;
+}
+
+#endif /* __ACS_PROTO_H */
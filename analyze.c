@@ -0,0 +1,219 @@
+/*
+ * Offline analysis of recorded survey samples
+ *
+ * acs analyze runs the same scoring used for live surveys over a corpus
+ * of sample records, one record per task on a work-stealing pool, so a
+ * change to the scoring can be re-evaluated across a fleet's worth of
+ * recordings on every core of a workstation.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acs.h"
+
+struct analyze_result {
+	int samples;
+	__u16 ideal_freq;
+	long double factor;
+};
+
+struct analyze_job {
+	char **paths;
+	unsigned int nr_paths;
+	__u64 from;
+	__u64 to;
+	long double rank_quantile;
+	struct analyze_result *results;
+};
+
+static void analyze_usage(void)
+{
+	printf("Usage:\tacs analyze [options] [<record> ...]\n");
+	printf("Options:\n");
+	printf("\t--jobs <n>\tnumber of worker threads, defaults to the number of CPUs\n");
+	printf("\t--index <file>\tanalyze the records listed in this index file\n");
+	printf("\t--from <sec>\tignore samples taken before this time (seconds since the epoch)\n");
+	printf("\t--to <sec>\tignore samples taken after this time (seconds since the epoch)\n");
+	printf("\t--rank <how>\trank channels by mean, p50, p95 or any pNN, default mean\n");
+}
+
+static void analyze_one(unsigned int task, void *arg)
+{
+	struct analyze_job *job = arg;
+	struct analyze_result *res = &job->results[task];
+	struct freq_item *ideal;
+	struct acs_ctx ctx;
+
+	acs_ctx_init(&ctx);
+	ctx.params.rank_quantile = job->rank_quantile;
+
+	res->samples = record_load(&ctx, job->paths[task], job->from, job->to);
+	if (res->samples > 0) {
+		score_freq_list(&ctx);
+		ideal = get_ideal_freq(&ctx);
+		if (ideal) {
+			res->ideal_freq = ideal->center_freq;
+			res->factor = ideal->interference_factor;
+		}
+	}
+
+	clean_freq_list(&ctx);
+}
+
+static int add_path(struct analyze_job *job, const char *path)
+{
+	char **paths;
+
+	paths = realloc(job->paths, (job->nr_paths + 1) * sizeof(char *));
+	if (!paths)
+		return -ENOMEM;
+	job->paths = paths;
+	job->paths[job->nr_paths] = strdup(path);
+	if (!job->paths[job->nr_paths])
+		return -ENOMEM;
+	job->nr_paths++;
+
+	return 0;
+}
+
+/* Picks the records from the index whose time range overlaps [from, to] */
+static int read_index(struct analyze_job *job, const char *index_path)
+{
+	unsigned long long first, last;
+	char line[4096], path[4096];
+	FILE *fp;
+	int err = 0;
+
+	fp = fopen(index_path, "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s: %s\n",
+			index_path, strerror(errno));
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%llu %llu %4095s", &first, &last, path) != 3)
+			continue;
+		if (last < job->from || (job->to && first > job->to))
+			continue;
+		err = add_path(job, path);
+		if (err)
+			break;
+	}
+
+	fclose(fp);
+	return err;
+}
+
+static void print_votes(struct analyze_job *job)
+{
+	unsigned int i, j, nr_freqs = 0;
+	struct {
+		__u16 freq;
+		unsigned int votes;
+	} votes[256];
+
+	for (i = 0; i < job->nr_paths; i++) {
+		if (!job->results[i].ideal_freq)
+			continue;
+		for (j = 0; j < nr_freqs; j++)
+			if (votes[j].freq == job->results[i].ideal_freq)
+				break;
+		if (j == nr_freqs) {
+			if (nr_freqs == ARRAY_SIZE(votes))
+				continue;
+			votes[nr_freqs].freq = job->results[i].ideal_freq;
+			votes[nr_freqs].votes = 0;
+			nr_freqs++;
+		}
+		votes[j].votes++;
+	}
+
+	for (j = 0; j < nr_freqs; j++)
+		printf("%d MHz: ideal in %u of %u records\n",
+		       votes[j].freq, votes[j].votes, job->nr_paths);
+}
+
+int analyze_main(int argc, char **argv)
+{
+	struct analyze_job job;
+	struct analyze_result *res;
+	unsigned int jobs = 0, i;
+	char *index_path = NULL;
+	int err = 0;
+
+	memset(&job, 0, sizeof(job));
+
+	while (argc > 0 && strncmp(*argv, "--", 2) == 0) {
+		if (argc < 2) {
+			analyze_usage();
+			return 1;
+		}
+		if (strcmp(*argv, "--jobs") == 0)
+			jobs = strtoul(argv[1], NULL, 0);
+		else if (strcmp(*argv, "--index") == 0)
+			index_path = argv[1];
+		else if (strcmp(*argv, "--from") == 0)
+			job.from = strtoull(argv[1], NULL, 0) * 1000;
+		else if (strcmp(*argv, "--to") == 0)
+			job.to = strtoull(argv[1], NULL, 0) * 1000;
+		else if (strcmp(*argv, "--rank") == 0) {
+			if (acs_parse_rank(argv[1], &job.rank_quantile)) {
+				analyze_usage();
+				return 1;
+			}
+		} else {
+			analyze_usage();
+			return 1;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (index_path)
+		err = read_index(&job, index_path);
+	while (!err && argc-- > 0)
+		err = add_path(&job, *argv++);
+	if (err)
+		goto out;
+
+	if (!job.nr_paths) {
+		analyze_usage();
+		err = 1;
+		goto out;
+	}
+
+	job.results = calloc(job.nr_paths, sizeof(struct analyze_result));
+	if (!job.results) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	err = pool_run(job.nr_paths, jobs, analyze_one, &job);
+	if (err)
+		goto out;
+
+	for (i = 0; i < job.nr_paths; i++) {
+		res = &job.results[i];
+		if (res->samples < 0)
+			printf("%s: failed: %s\n", job.paths[i], strerror(-res->samples));
+		else if (!res->ideal_freq)
+			printf("%s: %d samples, no ideal freq\n",
+			       job.paths[i], res->samples);
+		else
+			printf("%s: %d samples, ideal freq: %d MHz (%Lf)\n",
+			       job.paths[i], res->samples,
+			       res->ideal_freq, res->factor);
+	}
+
+	print_votes(&job);
+ out:
+	for (i = 0; i < job.nr_paths; i++)
+		free(job.paths[i]);
+	free(job.paths);
+	free(job.results);
+	return err;
+}
@@ -0,0 +1,197 @@
+/*
+ * Anytime answers
+ *
+ * Once every channel has been surveyed there is a best channel, it just
+ * is not known how sure that is yet. Rather than having the AP wait for
+ * the whole survey the best channel so far is published after every
+ * round along with the confidence that it beats the runner up, so the AP
+ * can start on it right away and move only if later rounds say otherwise.
+ *
+ * To keep the AP from bouncing between channels that are about as good
+ * as each other the published channel only changes once the new best
+ * channel beats it at ANSWER_SWITCH_CONFIDENCE.
+ *
+ * Answers go to a callback and can be kept in a results file:
+ *
+ *	# acs-result 2
+ *	freq <MHz>
+ *	factor <interference factor>
+ *	confidence <probability freq beats the runner up>
+ *	round <rounds surveyed>
+ *	final <0 or 1>
+ *	thin <1 if quick survey coverage is too thin to trust, else 0>
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "acs.h"
+#include "acs_proto.h"
+
+#define RESULT_VERSION	2
+
+/*
+ * Probability @a, ranked by @score_a, is better than @b, ranked by
+ * @score_b, from the spread of the factors of their dwells.
+ */
+static long double beats(const struct chan_stats *a, long double score_a,
+			 const struct chan_stats *b, long double score_b)
+{
+	long double se2;
+
+	se2 = chan_stats_variance(a) / a->count + chan_stats_variance(b) / b->count;
+	if (se2 <= 0)
+		return score_a < score_b ? 1 : score_a > score_b ? 0 : 0.5L;
+
+	return normal_cdf((score_b - score_a) / sqrtl(se2));
+}
+
+/* Probability @freq ranks better than @rival */
+static long double freq_confidence(struct acs_ctx *ctx, struct freq_item *freq,
+				   struct freq_item *rival)
+{
+	if (!rival)
+		return 1;
+	if (freq->live_stats.count < 2 || rival->live_stats.count < 2)
+		return 0.5;
+	return beats(&freq->live_stats, freq_rank_factor(ctx, freq),
+		     &rival->live_stats, freq_rank_factor(ctx, rival));
+}
+
+/*
+ * Works out the answer after @round rounds and hands it to the answer
+ * callback, if the survey is over @final is set.
+ */
+void publish_answer(struct acs_ctx *ctx, unsigned int round, bool final)
+{
+	struct acs_answer *answer = &ctx->answer;
+	struct freq_item *freq, *best = NULL, *runner_up = NULL, *cur;
+	long double score, best_score = 0, runner_up_score = 0;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (!freq->enabled || !freq->live_stats.count)
+			continue;
+		score = freq_rank_factor(ctx, freq);
+		if (!best || score < best_score) {
+			runner_up = best;
+			runner_up_score = best_score;
+			best = freq;
+			best_score = score;
+		} else if (!runner_up || score < runner_up_score) {
+			runner_up = freq;
+			runner_up_score = score;
+		}
+	}
+
+	if (!best)
+		return;
+
+	cur = answer->freq ? find_freq_item(ctx, answer->freq) : NULL;
+	if (!cur || final ||
+	    freq_confidence(ctx, best, cur) >= ANSWER_SWITCH_CONFIDENCE)
+		cur = best;
+
+	answer->changed = answer->freq != cur->center_freq;
+	answer->freq = cur->center_freq;
+	answer->factor = freq_rank_factor(ctx, cur);
+	answer->confidence = freq_confidence(ctx, cur, cur == best ? runner_up : best);
+	answer->round = round;
+	answer->final = final;
+
+	if (ctx->on_answer)
+		ctx->on_answer(answer, ctx->on_answer_arg);
+}
+
+int acs_answer_save(const char *path, const struct acs_answer *answer)
+{
+	char tmp[4096];
+	FILE *fp;
+
+	/* Written aside and renamed so readers never see half an answer */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "w");
+	if (!fp)
+		return -errno;
+
+	fprintf(fp, "# acs-result %d\n", RESULT_VERSION);
+	fprintf(fp, "freq %u\n", answer->freq);
+	fprintf(fp, "factor %.17Lg\n", answer->factor);
+	fprintf(fp, "confidence %.4Lf\n", answer->confidence);
+	fprintf(fp, "round %u\n", answer->round);
+	fprintf(fp, "final %d\n", answer->final);
+	fprintf(fp, "thin %d\n", answer->thin);
+
+	if (fclose(fp) || rename(tmp, path)) {
+		unlink(tmp);
+		return -errno;
+	}
+	return 0;
+}
+
+static __s32 thousandths(long double value)
+{
+	return (__s32) llroundl(value * 1000);
+}
+
+static __u16 ten_thousandths(long double ratio)
+{
+	if (ratio < 0)
+		ratio = 0;
+	if (ratio > 1)
+		ratio = 1;
+	return (__u16) llroundl(ratio * 10000);
+}
+
+static int chan_info_cmp(const void *a, const void *b)
+{
+	const struct acs_chan_info *ca = a, *cb = b;
+
+	if (ca->factor != cb->factor)
+		return ca->factor < cb->factor ? -1 : 1;
+	return ca->freq - cb->freq;
+}
+
+/*
+ * Fills @chans with up to @max of the channels surveyed, best first, and
+ * returns how many it filled.
+ */
+unsigned int ranking_build(struct acs_ctx *ctx, struct acs_chan_info *chans,
+			   unsigned int max)
+{
+	struct acs_chan_info *info;
+	struct freq_item *freq;
+	unsigned int nr = 0;
+
+	score_freq_list(ctx);
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (dl_list_empty(&freq->survey_list) || !freq->enabled)
+			continue;
+		if (nr == max)
+			break;
+
+		info = &chans[nr++];
+		memset(info, 0, sizeof(*info));
+		info->freq = freq->center_freq;
+		if (freq->in_use)
+			info->flags |= ACS_CHAN_IN_USE;
+		if (freq->dominated)
+			info->flags |= ACS_CHAN_DOMINATED;
+		info->min_noise = freq->min_noise;
+		info->max_noise = freq->max_noise;
+		info->samples = freq->survey_count;
+		info->factor = thousandths(freq->interference_factor);
+		info->mean = thousandths(freq->live_stats.mean);
+		info->stddev = thousandths(chan_stats_stddev(&freq->live_stats));
+		info->busy_p50 = ten_thousandths(sketch_quantile(&freq->busy_sketch, 0.5L));
+		info->busy_p95 = ten_thousandths(sketch_quantile(&freq->busy_sketch, 0.95L));
+	}
+
+	qsort(chans, nr, sizeof(*chans), chan_info_cmp);
+
+	return nr;
+}
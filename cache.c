@@ -0,0 +1,112 @@
+/*
+ * Survey result cache
+ *
+ * Scripts bringing a device up may run acs several times in a row, once
+ * per SSID or on every retry, and the channels do not change in between.
+ * The samples of a survey are kept in a cache directory, by default one
+ * in /run so they never outlive a reboot, keyed by the wiphy surveyed,
+ * the regulatory domain and the set of channels enabled:
+ *
+ *	<dir>/<wiphy>-<alpha2>-<hash of the channel set>.samples
+ *
+ * in the sample record format, see record.c. A survey of the same key
+ * within the cache TTL loads them and answers right away, or surveys only
+ * a few rounds on top of them when partially refreshing. The ranking and
+ * every per-channel statistic are rebuilt from the samples as they load,
+ * so the cache never disagrees with what a survey would have computed.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "acs.h"
+
+/* FNV-1a over the center frequencies of the enabled channels */
+static __u32 freq_set_hash(struct acs_ctx *ctx)
+{
+	struct freq_item *freq;
+	__u32 hash = 2166136261u;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (!freq->enabled)
+			continue;
+		hash ^= freq->center_freq & 0xff;
+		hash *= 16777619;
+		hash ^= freq->center_freq >> 8;
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+int cache_path(char *path, size_t len, const char *dir,
+	       const struct wiphy_id *id, struct acs_ctx *ctx)
+{
+	int ret;
+
+	ret = snprintf(path, len, "%s/%s-%s-%08x.samples", dir,
+		       id->name[0] ? id->name : "phy",
+		       id->alpha2[0] ? id->alpha2 : "00",
+		       freq_set_hash(ctx));
+	if (ret < 0 || (size_t) ret >= len)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/*
+ * Loads the samples cached at @path unless they are @ttl seconds old or
+ * older. Returns the number of samples loaded, 0 if there were none to
+ * use, or a negative error code.
+ */
+int cache_load(struct acs_ctx *ctx, const char *path, unsigned int ttl)
+{
+	struct sample_record *rec = ctx->record;
+	struct stat st;
+	int loaded;
+
+	if (stat(path, &st))
+		return 0;
+	if (time(NULL) - st.st_mtime >= (time_t) ttl)
+		return 0;
+
+	/* They were recorded when surveyed, not again */
+	ctx->record = NULL;
+	loaded = record_load(ctx, path, 0, 0);
+	ctx->record = rec;
+
+	return loaded;
+}
+
+/* Replaces the samples cached at @path with the ones kept in @ctx */
+int cache_save(struct acs_ctx *ctx, const char *path)
+{
+	struct sample_record *rec;
+	char tmp[4096], *slash;
+	int err;
+
+	snprintf(tmp, sizeof(tmp), "%s", path);
+	slash = strrchr(tmp, '/');
+	if (slash) {
+		*slash = '\0';
+		mkdir(tmp, 0755);
+	}
+
+	/* Written aside and renamed so a concurrent run never reads half */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	rec = record_open(tmp, ctx->params.dwell);
+	if (!rec)
+		return -EIO;
+	record_freq_surveys(ctx, rec);
+
+	err = record_close(rec, NULL);
+	if (!err && rename(tmp, path))
+		err = -errno;
+	if (err)
+		unlink(tmp);
+	return err;
+}
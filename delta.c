@@ -0,0 +1,186 @@
+/*
+ * Survey counter deltas
+ *
+ * Drivers do not agree on what the survey channel time counters mean.
+ * Some accumulate them for as long as the device is up, some reset them
+ * every time the radio tunes to the channel, and some keep them in 32
+ * bits and let them wrap. Scoring wants the time spent on a channel during
+ * one dwell and how much of it was busy, so every survey entry is turned
+ * into a delta against the previous snapshot of the same channel here
+ * before it is used.
+ *
+ * The counter semantics are learned as we go:
+ *
+ *	- a counter that goes backwards was either reset or wrapped. It
+ *	  wrapped if it was in the upper half of 32 bits and the distance
+ *	  through the wrap fits the time that has elapsed, otherwise the
+ *	  driver resets its counters.
+ *	- a channel time larger than the monotonic time elapsed since the
+ *	  previous snapshot, taken during an earlier dwell, cannot belong to
+ *	  a single dwell, so the driver accumulates its counters.
+ *
+ * Until either is observed counters are assumed to be cumulative, as is
+ * the case for most mac80211 drivers.
+ */
+
+#include <time.h>
+
+#include "acs.h"
+
+/* Scheduling jitter tolerated when comparing counters to elapsed time */
+#define DELTA_SLACK_MS		20
+#define COUNTER_WRAP		(1ULL << 32)
+
+__u64 monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+const char *counter_mode_name(enum counter_mode mode)
+{
+	switch (mode) {
+	case COUNTERS_CUMULATIVE:
+		return "cumulative";
+	case COUNTERS_RESET:
+		return "reset per dwell";
+	default:
+		return "unknown";
+	}
+}
+
+static bool counter_wrapped(__u64 cur, __u64 prev, __u64 elapsed)
+{
+	if (prev >= COUNTER_WRAP || prev < COUNTER_WRAP / 2)
+		return false;
+
+	return cur + COUNTER_WRAP - prev <= elapsed + DELTA_SLACK_MS;
+}
+
+static __u64 counter_delta(__u64 cur, __u64 prev, __u64 elapsed)
+{
+	if (cur >= prev)
+		return cur - prev;
+	if (counter_wrapped(cur, prev, elapsed))
+		return cur + COUNTER_WRAP - prev;
+	return cur;
+}
+
+/* Marks the start of a new dwell on @freq */
+void survey_dwell_start(struct freq_item *freq)
+{
+	freq->dwell_seq++;
+	freq->stale = false;
+}
+
+static enum survey_delta_ret __survey_delta(struct acs_ctx *ctx,
+					    struct freq_item *freq,
+					    struct survey_sample *sample,
+					    bool update)
+{
+	struct survey_snapshot *prev = &freq->snapshot;
+	struct survey_snapshot cur;
+	__u64 elapsed;
+	bool restart = false;
+
+	cur.valid = true;
+	cur.mono = monotonic_ms();
+	cur.dwell_seq = freq->dwell_seq;
+	cur.channel_time = sample->channel_time;
+	cur.channel_time_busy = sample->channel_time_busy;
+	cur.channel_time_rx = sample->channel_time_rx;
+	cur.channel_time_tx = sample->channel_time_tx;
+
+	if (!prev->valid) {
+		if (update)
+			*prev = cur;
+		return SURVEY_DELTA_BASELINE;
+	}
+
+	elapsed = cur.mono - prev->mono;
+
+	/*
+	 * Counters reset every dwell can come out the same for two dwells
+	 * of a quiet channel, they are only stale if no dwell started in
+	 * between. A peek in the middle of a dwell is taken for stale
+	 * either way, looking again costs less than ending the dwell on
+	 * the counters of the previous one.
+	 */
+	if (cur.channel_time == prev->channel_time &&
+	    cur.channel_time_busy == prev->channel_time_busy &&
+	    cur.channel_time_tx == prev->channel_time_tx &&
+	    (!update || ctx->counter_mode != COUNTERS_RESET ||
+	     cur.dwell_seq == prev->dwell_seq)) {
+		if (update) {
+			prev->mono = cur.mono;
+			prev->dwell_seq = cur.dwell_seq;
+		}
+		return SURVEY_DELTA_STALE;
+	}
+
+	if (cur.channel_time < prev->channel_time) {
+		if (!counter_wrapped(cur.channel_time, prev->channel_time, elapsed)) {
+			ctx->counter_mode = COUNTERS_RESET;
+			restart = true;
+		}
+	} else if (cur.dwell_seq == prev->dwell_seq) {
+		/*
+		 * Another snapshot within the same dwell, counters of either
+		 * kind only grew since the previous one and the time elapsed
+		 * says nothing about which kind they are.
+		 */
+	} else if (cur.channel_time > elapsed + DELTA_SLACK_MS) {
+		ctx->counter_mode = COUNTERS_CUMULATIVE;
+	} else if (ctx->counter_mode == COUNTERS_RESET &&
+		   cur.dwell_seq != prev->dwell_seq) {
+		/* Counters started over when we tuned back to the channel */
+		restart = true;
+	}
+
+	if (!restart) {
+		sample->channel_time = counter_delta(cur.channel_time,
+						     prev->channel_time, elapsed);
+		sample->channel_time_busy = counter_delta(cur.channel_time_busy,
+							  prev->channel_time_busy,
+							  elapsed);
+		sample->channel_time_rx = counter_delta(cur.channel_time_rx,
+							prev->channel_time_rx,
+							elapsed);
+		sample->channel_time_tx = counter_delta(cur.channel_time_tx,
+							prev->channel_time_tx,
+							elapsed);
+	}
+
+	if (update)
+		*prev = cur;
+
+	return SURVEY_DELTA_FRESH;
+}
+
+/*
+ * Turns the raw counters in @sample into the counters accumulated since
+ * the previous snapshot of @freq and records @sample as the new snapshot.
+ * Returns SURVEY_DELTA_BASELINE if there was nothing to compute a delta
+ * against, in which case @sample is left holding the raw counters, and
+ * SURVEY_DELTA_STALE if the driver reported exactly the same counters as
+ * last time, that is it did not update them for the last dwell. Counters
+ * reset every dwell are only stale if no dwell started since.
+ */
+enum survey_delta_ret survey_delta(struct acs_ctx *ctx, struct freq_item *freq,
+				   struct survey_sample *sample)
+{
+	return __survey_delta(ctx, freq, sample, true);
+}
+
+/*
+ * Like survey_delta() but leaves the snapshot of @freq alone, for looking
+ * at the counters of a dwell that is still in progress.
+ */
+enum survey_delta_ret survey_peek_delta(struct acs_ctx *ctx,
+					struct freq_item *freq,
+					struct survey_sample *sample)
+{
+	return __survey_delta(ctx, freq, sample, false);
+}
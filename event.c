@@ -2,159 +2,263 @@
 #include <stdbool.h>
 #include <net/if.h>
 #include <errno.h>
+#include <string.h>
+#include <syslog.h>
 #include "acs.h"
 
-struct dl_list offchan_ops_list = {
-        (&offchan_ops_list),
-        (&offchan_ops_list),
-};
-
-struct offchan_ev {
-	int ifidx;
-	int freq;
-	__u32 duration;
-	__u64 cookie;
-};
-
-struct wait_event {
-	int n_cmds;
-	const __u32 *cmds;
-	bool completed;
-	struct offchan_ev ev; /* use union later for other events */
-};
-
-struct offchan_op {
-	struct offchan_ev ev;
-	struct dl_list list_member;
-};
-
 static int no_seq_check(struct nl_msg *msg, void *arg)
 {
 	return NL_OK;
 }
 
-static bool offchan_ops_match(struct offchan_op *op1, struct offchan_op *op2)
+/*
+ * Operations of other applications are kept in a fixed size open
+ * addressing table with linear probing, so neither an event nor a missed
+ * cancel ever costs more than a bounded probe, or any memory. Removal
+ * shifts the entries after the freed slot back so no tombstones are
+ * needed. An operation whose cancel we never saw is evicted by the first
+ * operation added once it is OFFCHAN_OP_MAX_AGE ms past its duration, or
+ * sooner if the table is full and it is the oldest one.
+ */
+static unsigned int offchan_op_hash(__u64 wdev, __u64 cookie)
 {
-	/*
-	 * Note we do not check for the duration, just checking for the
-	 * cookie should be enough though
-	 */
-	if (op1->ev.ifidx != op2->ev.ifidx)
-		return false;
-	if (op1->ev.freq != op2->ev.freq)
-		return false;
-	if (op1->ev.cookie != op2->ev.cookie)
-		return false;
-	return true;
+	__u64 key = cookie ^ (wdev << 32 | wdev >> 32);
+
+	/* Fibonacci hashing, cookies are handed out sequentially */
+	return (key * 0x9e3779b97f4a7c15ULL) >> 32 & (OFFCHAN_OPS_MAX - 1);
+}
+
+static bool offchan_op_expired(struct offchan_op *op, __u64 now)
+{
+	return now > op->start + op->duration + OFFCHAN_OP_MAX_AGE;
+}
+
+static struct offchan_op *offchan_op_find(struct nl80211_state *state,
+					  __u64 wdev, __u64 cookie)
+{
+	unsigned int i, slot = offchan_op_hash(wdev, cookie);
+	struct offchan_op *op;
+
+	for (i = 0; i < OFFCHAN_OPS_MAX; i++) {
+		op = &state->offchan_ops[(slot + i) & (OFFCHAN_OPS_MAX - 1)];
+		if (!op->wdev)
+			return NULL;
+		if (op->wdev == wdev && op->cookie == cookie)
+			return op;
+	}
+
+	return NULL;
 }
 
-static int wait_sanity_check(struct nl_msg *msg, struct wait_event *wait)
+static void offchan_op_del(struct nl80211_state *state, struct offchan_op *op)
 {
+	unsigned int hole = op - state->offchan_ops, i, n, home;
+	struct offchan_op *next;
+
+	for (n = 1; n < OFFCHAN_OPS_MAX; n++) {
+		i = (op - state->offchan_ops + n) & (OFFCHAN_OPS_MAX - 1);
+		next = &state->offchan_ops[i];
+		if (!next->wdev)
+			break;
+		/* Entries probed from at or before the hole move into it */
+		home = offchan_op_hash(next->wdev, next->cookie);
+		if (((i - home) & (OFFCHAN_OPS_MAX - 1)) <
+		    ((i - hole) & (OFFCHAN_OPS_MAX - 1)))
+			continue;
+		state->offchan_ops[hole] = *next;
+		hole = i;
+	}
+
+	memset(&state->offchan_ops[hole], 0, sizeof(struct offchan_op));
+	state->nr_offchan_ops--;
+}
+
+/* Evicts the operations that outlived their duration by far */
+static void offchan_op_expire(struct nl80211_state *state, __u64 now)
+{
+	struct offchan_op *op, *oldest = NULL;
+	unsigned int i;
+
+	for (i = 0; i < OFFCHAN_OPS_MAX; i++) {
+		op = &state->offchan_ops[i];
+		/* The slot may get an entry shifted back, look at it again */
+		while (op->wdev && offchan_op_expired(op, now))
+			offchan_op_del(state, op);
+	}
+
+	if (state->nr_offchan_ops < OFFCHAN_OPS_MAX)
+		return;
+
+	for (i = 0; i < OFFCHAN_OPS_MAX; i++) {
+		op = &state->offchan_ops[i];
+		if (!oldest || op->start < oldest->start)
+			oldest = op;
+	}
+	offchan_op_del(state, oldest);
+}
+
+static void offchan_op_add(struct nl80211_state *state,
+			   const struct offchan_op *new)
+{
+	unsigned int slot = offchan_op_hash(new->wdev, new->cookie);
+	struct offchan_op *op;
+
+	/* A pass over a table this small is cheap enough for every add */
+	offchan_op_expire(state, new->start);
+
+	for (;; slot = (slot + 1) & (OFFCHAN_OPS_MAX - 1)) {
+		op = &state->offchan_ops[slot];
+		if (!op->wdev)
+			break;
+		/* The same operation again, refresh it */
+		if (op->wdev == new->wdev && op->cookie == new->cookie) {
+			*op = *new;
+			return;
+		}
+	}
+
+	*op = *new;
+	state->nr_offchan_ops++;
+}
+
+static int offchan_event(struct nl_msg *msg, void *arg)
+{
+	struct nl80211_state *state = arg;
+	struct offchan_dwell *dwell = state->dwell;
 	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
 	struct nlattr *tb[NL80211_ATTR_MAX + 1];
-	char ifname[100];
-	struct offchan_op *op, *tmp;
+	char ifname[100] = "";
+	struct offchan_op *op;
 	struct offchan_op op_now;
+	int ifidx = 0;
 
 	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
 		  genlmsg_attrlen(gnlh, 0), NULL);
 
-	if (!tb[NL80211_ATTR_IFINDEX] ||
-	    !tb[NL80211_ATTR_WIPHY_FREQ]) {
-		printf("Invalid data passed on event\n");
-		return -EINVAL;
+	/* The groups are shared by every wiphy, only ours has our counters */
+	if (!tb[NL80211_ATTR_WIPHY] ||
+	    nla_get_u32(tb[NL80211_ATTR_WIPHY]) != state->wiphy)
+		return NL_SKIP;
+
+	/*
+	 * Whoever scanned, wpa_supplicant, hostapd or the kernel itself,
+	 * left fresh survey counters behind on every channel it visited.
+	 */
+	if (gnlh->cmd == NL80211_CMD_NEW_SCAN_RESULTS ||
+	    gnlh->cmd == NL80211_CMD_NEW_SURVEY_RESULTS) {
+		state->scanned = true;
+		return NL_SKIP;
 	}
-	
-	op_now.ev.ifidx = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
-	op_now.ev.freq = nla_get_u32(tb[NL80211_ATTR_WIPHY_FREQ]);
-	op_now.ev.cookie = nla_get_u64(tb[NL80211_ATTR_COOKIE]);
 
-	if (tb[NL80211_ATTR_DURATION])
-		op_now.ev.duration = nla_get_u32(tb[NL80211_ATTR_DURATION]);
+	if (gnlh->cmd != NL80211_CMD_REMAIN_ON_CHANNEL &&
+	    gnlh->cmd != NL80211_CMD_CANCEL_REMAIN_ON_CHANNEL)
+		return NL_SKIP;
+
+	/*
+	 * A P2P Device has no netdev, its operations only carry the
+	 * wireless device. Those are just as good a sample as any.
+	 */
+	if ((!tb[NL80211_ATTR_WDEV] && !tb[NL80211_ATTR_IFINDEX]) ||
+	    !tb[NL80211_ATTR_WIPHY_FREQ] ||
+	    !tb[NL80211_ATTR_COOKIE]) {
+		acs_log(&state->log, LOG_DEBUG, "Invalid data passed on event");
+		return NL_SKIP;
+	}
+
+	if (tb[NL80211_ATTR_IFINDEX]) {
+		ifidx = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
+		if_indextoname(ifidx, ifname);
+	}
+	if (tb[NL80211_ATTR_WDEV])
+		op_now.wdev = nla_get_u64(tb[NL80211_ATTR_WDEV]);
 	else
-		op_now.ev.duration = 0;
+		op_now.wdev = ifidx;
+	op_now.freq = nla_get_u32(tb[NL80211_ATTR_WIPHY_FREQ]);
+	op_now.cookie = nla_get_u64(tb[NL80211_ATTR_COOKIE]);
 
-	if_indextoname(op_now.ev.ifidx, ifname);
+	if (tb[NL80211_ATTR_DURATION])
+		op_now.duration = nla_get_u32(tb[NL80211_ATTR_DURATION]);
+	else
+		op_now.duration = 0;
 
 	switch (gnlh->cmd) {
 	/*
 	 * Theory of operation:
 	 *
 	 * We may get events for new events from other userspace apps doing
-	 * other offchannel operations. The best we can do then is to capture
-	 * the cookie for the command we sent (stored in the wait.ev) and then
-	 * check if the completed command matches the wait.ev's cookie. Otherwise
-	 * we add the received command onto a linked list, this lets us later
-	 * send the the kernel multiple offchannel op requests and just deal
-	 * with the completions at whatever order the kernel wants to follow.
-	 */ 
+	 * other offchannel operations. The kernel hands us the cookie of
+	 * our own request in its reply, so we only need to check whether
+	 * an event carries that cookie. Every other operation is kept in
+	 * the table until its cancel comes in, which makes its channel a
+	 * sample for the taking.
+	 */
 	case NL80211_CMD_REMAIN_ON_CHANNEL:
-		op = (struct offchan_op *) malloc(sizeof(struct offchan_op));
-
-		op->ev.freq = op_now.ev.freq;
-		op->ev.ifidx = op_now.ev.ifidx;
-		op->ev.cookie = op_now.ev.cookie;
-		op->ev.duration = op_now.ev.duration;
-
-		if (op->ev.freq == wait->ev.freq &&
-		    op->ev.ifidx == wait->ev.ifidx) {
-			wait->ev.duration = op->ev.duration;
-			wait->ev.cookie = op->ev.cookie;
-
-			printf("%s: remain on freq: %d MHz, duration: %dms, cookie %llx, completed: ",
-			       ifname,
-			       op_now.ev.freq,
-			       op_now.ev.duration,
-			       (unsigned long long) op_now.ev.cookie);
+		if (dwell && ifidx == dwell->ifidx &&
+		    op_now.cookie == dwell->cookie) {
+			dwell->started = true;
+			dwell->start = state->event_time;
+
+			acs_log(&state->log, LOG_DEBUG,
+				"%s: remain on freq: %d MHz, duration: %dms, cookie %llx",
+				ifname, op_now.freq, op_now.duration,
+				(unsigned long long) op_now.cookie);
+			break;
 		}
 
-		dl_list_add_tail(&offchan_ops_list, &op->list_member);
-
+		op_now.start = state->event_time;
+		offchan_op_add(state, &op_now);
 		break;
 	case NL80211_CMD_CANCEL_REMAIN_ON_CHANNEL:
-		dl_list_for_each_safe(op, tmp, &offchan_ops_list, struct offchan_op, list_member) {
-			if (!offchan_ops_match(op, &op_now))
-				continue;
-			if (wait->ev.cookie == op->ev.cookie) {
-				wait->completed = true;
-				printf("yes\n");
-			}
-			dl_list_del(&op->list_member);
-			free(op);
+		if (dwell && ifidx == dwell->ifidx &&
+		    op_now.cookie == dwell->cookie) {
+			dwell->ended = true;
+			dwell->end = state->event_time;
+			acs_log(&state->log, LOG_DEBUG,
+				"%s: remain on freq: %d MHz, cookie %llx completed",
+				ifname, op_now.freq,
+				(unsigned long long) op_now.cookie);
+			break;
 		}
-		break;
-	default:
-		printf("unknown event %d\n", gnlh->cmd);
+
+		op = offchan_op_find(state, op_now.wdev, op_now.cookie);
+		if (!op)
+			break;
+		/*
+		 * Someone else just spent a while on the channel, its survey
+		 * counters are a sample we did not pay for.
+		 */
+		if (state->nr_foreign < FOREIGN_MAX)
+			state->foreign[state->nr_foreign++] = op->freq;
+		offchan_op_del(state, op);
 		break;
 	}
 
-	fflush(stdout);
 	return NL_SKIP;
 }
 
-static int wait_event(struct nl_msg *msg, void *arg)
+int nl80211_add_membership_mlme(struct nl80211_state *state)
 {
-	struct wait_event *wait = arg;
-	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
-	int i;
+	int mcid, ret;
 
-	for (i = 0; i < wait->n_cmds; i++) {
-		if (gnlh->cmd == wait->cmds[i]) {
-			wait_sanity_check(msg, wait);
-		}
+	/* MLME multicast group */
+	mcid = nl_get_multicast_id(state->nl_sock, "nl80211", "mlme");
+	if (mcid >= 0) {
+		ret = nl_socket_add_membership(state->ev_sock, mcid);
+		if (ret)
+			return ret;
 	}
 
-	return NL_SKIP;
+	return 0;
 }
 
-int nl80211_add_membership_mlme(struct nl80211_state *state)
+/* Scan multicast group, for the survey counters other scans leave behind */
+int nl80211_add_membership_scan(struct nl80211_state *state)
 {
 	int mcid, ret;
 
-	/* MLME multicast group */
-	mcid = nl_get_multicast_id(state->nl_sock, "nl80211", "mlme");
+	mcid = nl_get_multicast_id(state->nl_sock, "nl80211", "scan");
 	if (mcid >= 0) {
-		ret = nl_socket_add_membership(state->nl_sock, mcid);
+		ret = nl_socket_add_membership(state->ev_sock, mcid);
 		if (ret)
 			return ret;
 	}
@@ -162,44 +266,37 @@ int nl80211_add_membership_mlme(struct nl80211_state *state)
 	return 0;
 }
 
-__u32 wait_for_offchan_op(struct nl80211_state *state,
-			  int devidx, int freq,
-			  const int n_waits, const __u32 *waits)
+/*
+ * Processes the offchannel events pending on the event socket and flags
+ * the start and end of the operation of ours in flight, if any, in
+ * state->dwell, and completed scans in state->scanned. Never blocks.
+ */
+void offchan_process(struct nl80211_state *state)
 {
-	struct nl_cb *cb = nl_cb_alloc(nl_debug ? NL_CB_DEBUG : NL_CB_DEFAULT);
-	struct wait_event wait;
+	struct nl_cb *cb;
 
-	if (!cb) {
-		fprintf(stderr, "failed to allocate netlink callbacks\n");
-		return -ENOMEM;
-	}
+	cb = nl_cb_alloc(state->debug ? NL_CB_DEBUG : NL_CB_DEFAULT);
+	if (!cb)
+		return;
 
 	/* no sequence checking for multicast messages */
 	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, no_seq_check, NULL);
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, offchan_event, state);
 
-	wait.cmds = waits;
-	wait.n_cmds = n_waits;
-	wait.ev.ifidx = devidx;
-	wait.ev.freq = freq;
-
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, wait_event, &wait);
-
-	wait.completed = 0;
-
-	while (!wait.completed)
-		nl_recvmsgs(state->nl_sock, cb);
+	/*
+	 * The socket is non-blocking, this stops once it runs dry. Netlink
+	 * does not timestamp its messages, every event is stamped as it is
+	 * read rather than once its whole batch is dispatched.
+	 */
+	do
+		state->event_time = monotonic_ms();
+	while (nl_recvmsgs(state->ev_sock, cb) >= 0);
 
 	nl_cb_put(cb);
-
-	return 0;
 }
 
-void clear_offchan_ops_list(void)
+void clear_offchan_ops(struct nl80211_state *state)
 {
-	struct offchan_op *op, *tmp;
-
-	dl_list_for_each_safe(op, tmp, &offchan_ops_list, struct offchan_op, list_member) {
-		dl_list_del(&op->list_member);
-		free(op);
-	}
+	memset(state->offchan_ops, 0, sizeof(state->offchan_ops));
+	state->nr_offchan_ops = 0;
 }
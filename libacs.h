@@ -0,0 +1,174 @@
+#ifndef __LIBACS_H
+#define __LIBACS_H
+
+/*
+ * libacs - automatic channel selection for 802.11 devices
+ *
+ * A survey runs in a session driven from the caller's own event loop:
+ * acs_session_fd() returns a single file descriptor that becomes readable
+ * whenever the session has something to do, the caller then calls
+ * acs_session_dispatch() which does it without ever blocking on the
+ * radio, and results come back through the callbacks given when the
+ * session was opened. The library keeps no global state, any number of
+ * sessions can run side by side.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <linux/types.h>
+
+/**
+ * struct acs_params - tunable scoring and sampling parameters
+ *
+ * @log2_clamp: busy and active times are clamped to this before log2()
+ * @noise_coeff: weight given to the noise floor in the interference factor
+ * @rank_quantile: if non zero channels are ranked by this quantile of their
+ *	busy ratio and noise rather than by their mean interference factor
+ * @dwell: time in ms to remain on each channel for each survey
+ * @rounds: number of times all channels get surveyed
+ * @adaptive: size each dwell from the busy ratio variance of its channel
+ *	and end it early once the busy ratio settles
+ * @min_dwell: shortest adaptive dwell in ms
+ * @max_dwell: longest adaptive dwell in ms, 0 for DWELL_MAX_FACTOR * @dwell
+ * @confidence: if non zero stop surveying channels that are worse than the
+ *	best one at this confidence level, and stop altogether once only the
+ *	best one is left; @rounds is then the most rounds that are run
+ * @snapshots: number of survey snapshots taken during each dwell, every
+ *	@dwell ms apart, so each remain on channel operation yields that
+ *	many samples
+ * @duty_cycle: most percent of any @duty_window to spend off channel, 0
+ *	for no limit
+ * @duty_window: window in ms the duty cycle applies to
+ * @traffic_aware: hold dwells back until the stations go quiet
+ * @budget: if non zero time in ms the whole survey has to fit in
+ * @in_use_hz: if non zero rate the operating channel is sampled at from
+ *	its own survey entry, it is then left out of the offchannel dwells
+ * @fresh_ttl: if non zero seconds the samples of the steadiest channels
+ *	stay fresh for, more volatile channels going stale sooner; rounds
+ *	after the survey is over then only visit the channels gone stale
+ */
+struct acs_params {
+	__u64 log2_clamp;
+	long double noise_coeff;
+	long double rank_quantile;
+	unsigned int dwell;
+	unsigned int rounds;
+	bool adaptive;
+	unsigned int min_dwell;
+	unsigned int max_dwell;
+	long double confidence;
+	unsigned int snapshots;
+	long double duty_cycle;
+	unsigned int duty_window;
+	bool traffic_aware;
+	unsigned int budget;
+	unsigned int in_use_hz;
+	unsigned int fresh_ttl;
+};
+
+/**
+ * struct acs_answer - best channel known so far
+ *
+ * @freq: channel to use, 0 if none is known yet
+ * @factor: the interference factor it is ranked by, see @rank_quantile,
+ *	against a 0 dBm noise floor
+ * @confidence: probability @freq is better than the best other channel
+ * @round: rounds surveyed when the answer was given
+ * @final: whether the survey is over
+ * @changed: whether @freq differs from the previous answer
+ * @thin: the answer of a quick survey on counters covering too little time
+ *	on some channel to be trusted, best refined by a full survey
+ */
+struct acs_answer {
+	__u16 freq;
+	long double factor;
+	long double confidence;
+	unsigned int round;
+	bool final;
+	bool changed;
+	bool thin;
+};
+
+typedef void (*answer_fn)(const struct acs_answer *answer, void *arg);
+typedef void (*log_fn)(int prio, const char *fmt, va_list ap, void *arg);
+
+/**
+ * struct acs_config - what a session surveys and how
+ *
+ * @ifname: interface to survey, it has to be up
+ * @params: scoring and sampling parameters
+ * @debug: dump netlink messages as they go by
+ * @profile_dir: directory driver profiles are kept in, NULL for none
+ * @record_path: if set every survey sample taken is recorded here
+ * @index_path: if set the record is added to this index when closed
+ * @interval: if non zero keep surveying one round every @interval seconds
+ *	once the survey is over
+ * @window: samples of each channel kept across those rounds, 0 for
+ *	@params.rounds; the operating channel sampled at @params.in_use_hz
+ *	keeps the ones of the time the other channels' samples span
+ * @cache_dir: directory survey results are cached in
+ * @cache_ttl: seconds cached results are answered from, 0 for no cache
+ * @cache_refresh: survey anyway, the cache is then only written
+ * @refresh_rounds: if non zero survey this many rounds on top of cached
+ *	results, which are trimmed to make room for them
+ */
+struct acs_config {
+	const char *ifname;
+	struct acs_params params;
+	bool debug;
+	const char *profile_dir;
+	const char *record_path;
+	const char *index_path;
+	unsigned int interval;
+	unsigned int window;
+	const char *cache_dir;
+	unsigned int cache_ttl;
+	bool cache_refresh;
+	unsigned int refresh_rounds;
+};
+
+/**
+ * struct acs_callbacks - how a session reports back
+ *
+ * @answer: if set called with every answer published, provisional ones
+ *	after every round and the final one at the end of the survey
+ * @done: if set called once the survey is over, with 0, or once the
+ *	session failed, with a negative error code. A session surveying
+ *	every interval keeps going after a successful survey.
+ * @log: if set called with every message of the session, @prio being a
+ *	syslog(3) priority; the library never prints anything on its own
+ */
+struct acs_callbacks {
+	answer_fn answer;
+	void (*done)(int err, void *arg);
+	log_fn log;
+};
+
+struct acs_session;
+/* See acs_proto.h */
+struct acs_chan_info;
+
+/* The library is built with hidden visibility, only what follows is exported */
+#pragma GCC visibility push(default)
+
+void acs_params_init(struct acs_params *params);
+int acs_parse_rank(const char *str, long double *rank_quantile);
+void acs_config_init(struct acs_config *config);
+int acs_answer_save(const char *path, const struct acs_answer *answer);
+
+int acs_session_open(struct acs_session **session,
+		     const struct acs_config *config,
+		     const struct acs_callbacks *cb, void *arg);
+void acs_session_close(struct acs_session *session);
+int acs_session_fd(struct acs_session *session);
+int acs_session_start(struct acs_session *session);
+int acs_session_dispatch(struct acs_session *session);
+int acs_session_quick(struct acs_session *session, unsigned int *thin);
+void acs_session_report(struct acs_session *session);
+unsigned int acs_session_ranking(struct acs_session *session,
+				 struct acs_chan_info *chans, unsigned int max);
+int acs_session_export(struct acs_session *session, const char *path);
+
+#pragma GCC visibility pop
+
+#endif /* __LIBACS_H */
@@ -0,0 +1,155 @@
+/*
+ * Fleet aggregation of per-channel statistics
+ *
+ * acs merge reduces any number of sample records and statistics exports,
+ * from any number of APs and runs, into one per-channel profile. Inputs
+ * are first turned into statistics tables in parallel, one input per
+ * task, and then merged pairwise in a tree: every level halves the number
+ * of tables and runs its merges in parallel, so thousands of inputs take
+ * a logarithmic number of levels. The result is itself an export and can
+ * be merged again.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acs.h"
+
+struct merge_job {
+	char **paths;
+	unsigned int nr_inputs;
+	struct stats_table *tables;
+	int *errs;
+	unsigned int stride;
+};
+
+static void merge_usage(void)
+{
+	printf("Usage:\tacs merge [options] <record|export> ...\n");
+	printf("Options:\n");
+	printf("\t--jobs <n>\tnumber of worker threads, defaults to the number of CPUs\n");
+	printf("\t--output <file>\twrite the merged statistics here instead of stdout\n");
+}
+
+static void merge_load(unsigned int task, void *arg)
+{
+	struct merge_job *job = arg;
+	struct acs_ctx ctx;
+	int err;
+
+	if (stats_file_is_export(job->paths[task])) {
+		job->errs[task] = stats_table_read(&job->tables[task],
+						   job->paths[task]);
+		return;
+	}
+
+	acs_ctx_init(&ctx);
+	err = record_load(&ctx, job->paths[task], 0, 0);
+	if (err > 0) {
+		score_freq_list(&ctx);
+		err = stats_table_from_ctx(&job->tables[task], &ctx);
+	}
+	clean_freq_list(&ctx);
+
+	job->errs[task] = err < 0 ? err : 0;
+}
+
+/*
+ * Merges table 2 * stride * task + stride into table 2 * stride * task,
+ * along with any error of an earlier level, so they all end up in table 0
+ */
+static void merge_pair(unsigned int task, void *arg)
+{
+	struct merge_job *job = arg;
+	unsigned int dst = 2 * job->stride * task;
+	unsigned int src = dst + job->stride;
+	int err;
+
+	if (job->errs[src] && !job->errs[dst])
+		job->errs[dst] = job->errs[src];
+	err = stats_table_merge(&job->tables[dst], &job->tables[src]);
+	if (err)
+		job->errs[dst] = err;
+	stats_table_free(&job->tables[src]);
+}
+
+int merge_main(int argc, char **argv)
+{
+	struct merge_job job;
+	unsigned int jobs = 0, i, pairs;
+	char *output = NULL;
+	int err = 0;
+
+	memset(&job, 0, sizeof(job));
+
+	while (argc > 0 && strncmp(*argv, "--", 2) == 0) {
+		if (argc < 2) {
+			merge_usage();
+			return 1;
+		}
+		if (strcmp(*argv, "--jobs") == 0)
+			jobs = strtoul(argv[1], NULL, 0);
+		else if (strcmp(*argv, "--output") == 0)
+			output = argv[1];
+		else {
+			merge_usage();
+			return 1;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc <= 0) {
+		merge_usage();
+		return 1;
+	}
+
+	job.paths = argv;
+	job.nr_inputs = argc;
+	job.tables = calloc(job.nr_inputs, sizeof(struct stats_table));
+	job.errs = calloc(job.nr_inputs, sizeof(int));
+	if (!job.tables || !job.errs) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	err = pool_run(job.nr_inputs, jobs, merge_load, &job);
+	if (err)
+		goto out;
+
+	for (i = 0; i < job.nr_inputs; i++) {
+		if (!job.errs[i])
+			continue;
+		fprintf(stderr, "%s: skipped: %s\n", job.paths[i],
+			strerror(-job.errs[i]));
+		stats_table_free(&job.tables[i]);
+		job.errs[i] = 0;
+	}
+
+	for (job.stride = 1; job.stride < job.nr_inputs; job.stride *= 2) {
+		pairs = (job.nr_inputs + job.stride - 1) / (2 * job.stride);
+		err = pool_run(pairs, jobs, merge_pair, &job);
+		if (err)
+			goto out;
+	}
+
+	if (job.errs[0]) {
+		err = job.errs[0];
+		fprintf(stderr, "merge failed: %s\n", strerror(-err));
+		goto out;
+	}
+
+	if (output)
+		err = stats_table_export(output, &job.tables[0]);
+	else
+		stats_table_write(stdout, &job.tables[0]);
+ out:
+	if (job.tables)
+		for (i = 0; i < job.nr_inputs; i++)
+			stats_table_free(&job.tables[i]);
+	free(job.tables);
+	free(job.errs);
+	return err;
+}
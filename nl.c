@@ -0,0 +1,498 @@
+/*
+ * nl80211 requests of a survey session
+ *
+ * Copyright 2007, 2008	Johannes Berg <johannes@sipsolutions.net>
+ * Copyright 2011	Luis R. Rodriguez <mcgrof@gmail.com>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+#include <netlink/genl/genl.h>
+#include <netlink/genl/family.h>
+#include <netlink/genl/ctrl.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+
+#include "nl80211.h"
+#include "acs.h"
+
+#ifdef CONFIG_LIBNL1
+/* libnl 1.0 compatibility code */
+static inline struct nl_handle *nl_socket_alloc(void)
+{
+	return nl_handle_alloc();
+}
+
+static inline void nl_socket_free(struct nl_sock *h)
+{
+	nl_handle_destroy(h);
+}
+
+static inline int __genl_ctrl_alloc_cache(struct nl_sock *h, struct nl_cache **cache)
+{
+	struct nl_cache *tmp = genl_ctrl_alloc_cache(h);
+	if (!tmp)
+		return -ENOMEM;
+	*cache = tmp;
+	return 0;
+}
+#define genl_ctrl_alloc_cache __genl_ctrl_alloc_cache
+#endif /* CONFIG_LIBNL1 */
+
+int nl80211_init(struct nl80211_state *state, bool debug)
+{
+	int err;
+
+	state->debug = debug;
+	state->in_use = NULL;
+	state->dwell = NULL;
+	clear_offchan_ops(state);
+
+	state->nl_sock = nl_socket_alloc();
+	if (!state->nl_sock) {
+		acs_log(&state->log, LOG_ERR, "Failed to allocate netlink socket.");
+		return -ENOMEM;
+	}
+
+	if (genl_connect(state->nl_sock)) {
+		acs_log(&state->log, LOG_ERR, "Failed to connect to generic netlink.");
+		err = -ENOLINK;
+		goto out_handle_destroy;
+	}
+
+	if (genl_ctrl_alloc_cache(state->nl_sock, &state->nl_cache)) {
+		acs_log(&state->log, LOG_ERR, "Failed to allocate generic netlink cache.");
+		err = -ENOMEM;
+		goto out_handle_destroy;
+	}
+
+	state->nl80211 = genl_ctrl_search_by_name(state->nl_cache, "nl80211");
+	if (!state->nl80211) {
+		acs_log(&state->log, LOG_ERR, "nl80211 not found.");
+		err = -ENOENT;
+		goto out_cache_free;
+	}
+
+	/*
+	 * Events get their own socket so they are never mixed up with the
+	 * replies to our requests, like a survey dump taken while we are
+	 * still off channel.
+	 */
+	state->ev_sock = nl_socket_alloc();
+	if (!state->ev_sock) {
+		acs_log(&state->log, LOG_ERR, "Failed to allocate netlink event socket.");
+		err = -ENOMEM;
+		goto out_family_put;
+	}
+
+	if (genl_connect(state->ev_sock)) {
+		acs_log(&state->log, LOG_ERR, "Failed to connect event socket to generic netlink.");
+		err = -ENOLINK;
+		goto out_ev_destroy;
+	}
+	nl_socket_set_nonblocking(state->ev_sock);
+
+	return 0;
+
+ out_ev_destroy:
+	nl_socket_free(state->ev_sock);
+ out_family_put:
+	genl_family_put(state->nl80211);
+ out_cache_free:
+	nl_cache_free(state->nl_cache);
+ out_handle_destroy:
+	nl_socket_free(state->nl_sock);
+	return err;
+}
+
+void nl80211_cleanup(struct nl80211_state *state)
+{
+	nl_socket_free(state->ev_sock);
+	genl_family_put(state->nl80211);
+	nl_cache_free(state->nl_cache);
+	nl_socket_free(state->nl_sock);
+}
+
+
+static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err,
+			 void *arg)
+{
+	int *ret = arg;
+	*ret = err->error;
+	return NL_STOP;
+}
+
+static int finish_handler(struct nl_msg *msg, void *arg)
+{
+	int *ret = arg;
+	*ret = 0;
+	return NL_SKIP;
+}
+
+static int ack_handler(struct nl_msg *msg, void *arg)
+{
+	int *ret = arg;
+	*ret = 0;
+	return NL_STOP;
+}
+
+/*
+ * Sends @msg and processes replies until the kernel acks it or reports an
+ * error, every reply is passed on to @valid. Frees @msg.
+ */
+static int send_and_recv(struct nl80211_state *state, struct nl_msg *msg,
+			 int (*valid)(struct nl_msg *, void *), void *arg)
+{
+	struct nl_cb *cb;
+	int err;
+
+	cb = nl_cb_alloc(state->debug ? NL_CB_DEBUG : NL_CB_DEFAULT);
+	if (!cb) {
+		acs_log(&state->log, LOG_ERR, "failed to allocate netlink callbacks");
+		err = 2;
+		goto out_free_msg;
+	}
+
+	err = nl_send_auto_complete(state->nl_sock, msg);
+	if (err < 0)
+		goto out;
+
+	err = 1;
+
+	nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &err);
+	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &err);
+	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &err);
+	if (valid)
+		nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, valid, arg);
+
+	while (err > 0)
+		nl_recvmsgs(state->nl_sock, cb);
+ out:
+	nl_cb_put(cb);
+ out_free_msg:
+	nlmsg_free(msg);
+	return err;
+}
+
+static struct nl_msg *nl80211_msg(struct nl80211_state *state, int flags,
+				  __u8 cmd, int devidx)
+{
+	struct nl_msg *msg;
+
+	msg = nlmsg_alloc();
+	if (!msg) {
+		acs_log(&state->log, LOG_ERR, "failed to allocate netlink message");
+		return NULL;
+	}
+
+	genlmsg_put(msg, 0, 0, genl_family_get_id(state->nl80211), 0,
+		    flags, cmd, 0);
+	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, devidx);
+
+	return msg;
+ nla_put_failure:
+	acs_log(&state->log, LOG_ERR, "building message failed");
+	nlmsg_free(msg);
+	return NULL;
+}
+
+static int __call_survey_freq(struct nl80211_state *state, int devidx,
+			      struct survey_req *req)
+{
+	struct nl_msg *msg;
+
+	msg = nl80211_msg(state, NLM_F_DUMP, NL80211_CMD_GET_SURVEY, devidx);
+	if (!msg)
+		return 2;
+
+	return send_and_recv(state, msg, handle_survey_dump, req);
+}
+
+int call_survey_freq(struct nl80211_state *state, struct acs_ctx *ctx,
+		     int devidx, int freq)
+{
+	struct survey_req req = {
+		.ctx = ctx,
+		.freq = freq,
+	};
+
+	return __call_survey_freq(state, devidx, &req);
+}
+
+/* Reads the current survey counters of @freq without using them */
+int peek_survey_freq(struct nl80211_state *state, struct acs_ctx *ctx,
+		     int devidx, int freq, struct survey_sample *peek)
+{
+	struct survey_req req = {
+		.ctx = ctx,
+		.freq = freq,
+		.peek = peek,
+	};
+
+	memset(peek, 0, sizeof(*peek));
+
+	return __call_survey_freq(state, devidx, &req);
+}
+
+int in_use_sampler_init(struct nl80211_state *state, struct acs_ctx *ctx,
+			int devidx, struct in_use_sampler *sampler)
+{
+	memset(sampler, 0, sizeof(*sampler));
+	sampler->req.ctx = ctx;
+	sampler->req.in_use = true;
+	sampler->period = ctx->params.in_use_hz < 1000 ?
+		1000 / ctx->params.in_use_hz : 1;
+
+	sampler->msg = nl80211_msg(state, NLM_F_DUMP, NL80211_CMD_GET_SURVEY,
+				   devidx);
+	if (!sampler->msg)
+		return 2;
+
+	sampler->cb = nl_cb_alloc(state->debug ? NL_CB_DEBUG : NL_CB_DEFAULT);
+	if (!sampler->cb) {
+		nlmsg_free(sampler->msg);
+		return 2;
+	}
+
+	nl_cb_err(sampler->cb, NL_CB_CUSTOM, error_handler, &sampler->err);
+	nl_cb_set(sampler->cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler,
+		  &sampler->err);
+	nl_cb_set(sampler->cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler,
+		  &sampler->err);
+	nl_cb_set(sampler->cb, NL_CB_VALID, NL_CB_CUSTOM, handle_survey_dump,
+		  &sampler->req);
+
+	state->in_use = sampler;
+	return 0;
+}
+
+void in_use_sampler_free(struct nl80211_state *state)
+{
+	if (!state->in_use)
+		return;
+	nl_cb_put(state->in_use->cb);
+	nlmsg_free(state->in_use->msg);
+	state->in_use = NULL;
+}
+
+/*
+ * Samples the operating channel if it is time to, a no-op without an
+ * operating channel sampler.
+ */
+int sample_in_use(struct nl80211_state *state)
+{
+	struct in_use_sampler *sampler = state->in_use;
+	__u64 now = monotonic_ms();
+	int err;
+
+	if (!sampler || now - sampler->last < sampler->period)
+		return 0;
+	sampler->last = now;
+
+	/* Have the request numbered anew every time it is sent */
+	nlmsg_hdr(sampler->msg)->nlmsg_seq = NL_AUTO_SEQ;
+	err = nl_send_auto_complete(state->nl_sock, sampler->msg);
+	if (err < 0)
+		return err;
+
+	sampler->err = 1;
+	while (sampler->err > 0)
+		nl_recvmsgs(state->nl_sock, sampler->cb);
+
+	return sampler->err;
+}
+
+static int roc_cookie_handler(struct nl_msg *msg, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct offchan_dwell *dwell = arg;
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+
+	if (tb[NL80211_ATTR_COOKIE])
+		dwell->cookie = nla_get_u64(tb[NL80211_ATTR_COOKIE]);
+
+	return NL_SKIP;
+}
+
+int go_offchan_freq(struct nl80211_state *state, struct offchan_dwell *dwell)
+{
+	struct nl_msg *msg;
+
+	msg = nl80211_msg(state, 0, NL80211_CMD_REMAIN_ON_CHANNEL, dwell->ifidx);
+	if (!msg)
+		return 2;
+
+	NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, dwell->freq);
+	/* The wiphy tells us the max allowed, values passed are in ms */
+	NLA_PUT_U32(msg, NL80211_ATTR_DURATION, dwell->duration);
+
+	dwell->requested = monotonic_ms();
+
+	return send_and_recv(state, msg, roc_cookie_handler, dwell);
+ nla_put_failure:
+	acs_log(&state->log, LOG_ERR, "building message failed");
+	nlmsg_free(msg);
+	return 2;
+}
+
+int cancel_offchan(struct nl80211_state *state, struct offchan_dwell *dwell)
+{
+	struct nl_msg *msg;
+	int err;
+
+	msg = nl80211_msg(state, 0, NL80211_CMD_CANCEL_REMAIN_ON_CHANNEL,
+			  dwell->ifidx);
+	if (!msg)
+		return 2;
+
+	NLA_PUT_U64(msg, NL80211_ATTR_COOKIE, dwell->cookie);
+
+	dwell->cancelled = true;
+	err = send_and_recv(state, msg, NULL, NULL);
+	/* The operation may have just expired on its own */
+	if (err == -ENOENT)
+		err = 0;
+	return err;
+ nla_put_failure:
+	acs_log(&state->log, LOG_ERR, "building message failed");
+	nlmsg_free(msg);
+	return 2;
+}
+
+static int wiphy_handler(struct nl_msg *msg, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct acs_ctx *ctx = arg;
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+
+	if (tb[NL80211_ATTR_MAX_REMAIN_ON_CHANNEL_DURATION])
+		ctx->max_roc_duration =
+			nla_get_u32(tb[NL80211_ATTR_MAX_REMAIN_ON_CHANNEL_DURATION]);
+
+	return NL_SKIP;
+}
+
+/* Learns the capabilities of the wiphy behind @devidx we care about */
+int get_wiphy_info(struct nl80211_state *state, struct acs_ctx *ctx,
+		   int devidx)
+{
+	struct nl_msg *msg;
+
+	msg = nl80211_msg(state, 0, NL80211_CMD_GET_WIPHY, devidx);
+	if (!msg)
+		return 2;
+
+	return send_and_recv(state, msg, wiphy_handler, ctx);
+}
+
+static int wiphy_id_handler(struct nl_msg *msg, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct wiphy_id *id = arg;
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+
+	if (tb[NL80211_ATTR_WIPHY_NAME])
+		snprintf(id->name, sizeof(id->name), "%s",
+			 nla_get_string(tb[NL80211_ATTR_WIPHY_NAME]));
+	if (tb[NL80211_ATTR_REG_ALPHA2])
+		snprintf(id->alpha2, sizeof(id->alpha2), "%s",
+			 nla_get_string(tb[NL80211_ATTR_REG_ALPHA2]));
+
+	return NL_SKIP;
+}
+
+/* Gets the name of the wiphy behind @devidx and the regulatory domain */
+int get_wiphy_id(struct nl80211_state *state, int devidx, struct wiphy_id *id)
+{
+	struct nl_msg *msg;
+	int err;
+
+	memset(id, 0, sizeof(*id));
+
+	msg = nl80211_msg(state, 0, NL80211_CMD_GET_WIPHY, devidx);
+	if (!msg)
+		return 2;
+	err = send_and_recv(state, msg, wiphy_id_handler, id);
+	if (err)
+		return err;
+
+	msg = nl80211_msg(state, 0, NL80211_CMD_GET_REG, devidx);
+	if (!msg)
+		return 2;
+	return send_and_recv(state, msg, wiphy_id_handler, id);
+}
+
+static int wiphy_index_handler(struct nl_msg *msg, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct nl80211_state *state = arg;
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+
+	if (tb[NL80211_ATTR_WIPHY])
+		state->wiphy = nla_get_u32(tb[NL80211_ATTR_WIPHY]);
+
+	return NL_SKIP;
+}
+
+/* Learns the index of the wiphy behind @devidx, events are matched on it */
+int get_wiphy_index(struct nl80211_state *state, int devidx)
+{
+	struct nl_msg *msg;
+
+	msg = nl80211_msg(state, 0, NL80211_CMD_GET_INTERFACE, devidx);
+	if (!msg)
+		return 2;
+
+	return send_and_recv(state, msg, wiphy_index_handler, state);
+}
+
+/*
+ * Does a full survey on all channels. Since drivers will only
+ * return survey data for channels they are allowed on we will
+ * disregard further study on any channels we did not get any
+ * survey data on. The counters from this dump are kept as the
+ * baseline the samples of the first dwell on each channel are
+ * computed against.
+ */
+int get_freq_list(struct nl80211_state *state, struct acs_ctx *ctx,
+		  int devidx)
+{
+	int err;
+
+	err = call_survey_freq(state, ctx, devidx, 0);
+	if (err)
+		return err;
+	annotate_enabled_chans(ctx);
+	clear_freq_surveys(ctx);
+
+	return 0;
+}
+
+int get_station_traffic(struct nl80211_state *state, int devidx,
+			struct station_traffic *traffic)
+{
+	struct nl_msg *msg;
+
+	memset(traffic, 0, sizeof(*traffic));
+
+	msg = nl80211_msg(state, NLM_F_DUMP, NL80211_CMD_GET_STATION, devidx);
+	if (!msg)
+		return 2;
+
+	return send_and_recv(state, msg, handle_station_dump, traffic);
+}
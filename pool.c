@@ -0,0 +1,166 @@
+/*
+ * Work-stealing thread pool for offline processing
+ *
+ * Tasks are numbered 0..nr_tasks-1 and handed out to the workers as
+ * contiguous ranges up front. A worker pops tasks off the front of its
+ * own range and, once it runs dry, steals the back half of the range of
+ * the first busy worker it finds. Recorded sample files vary a lot in
+ * size so this keeps every core busy until the last task is done
+ * without a central queue every worker would contend on.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "acs.h"
+
+struct pool_range {
+	pthread_mutex_t lock;
+	unsigned int head;
+	unsigned int tail;
+};
+
+struct pool {
+	unsigned int nr_workers;
+	struct pool_range *ranges;
+	pool_fn fn;
+	void *arg;
+};
+
+struct pool_worker {
+	struct pool *pool;
+	unsigned int id;
+	pthread_t thread;
+};
+
+unsigned int pool_default_workers(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? n : 1;
+}
+
+static bool pool_pop(struct pool_range *range, unsigned int *task)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&range->lock);
+	if (range->head < range->tail) {
+		*task = range->head++;
+		found = true;
+	}
+	pthread_mutex_unlock(&range->lock);
+
+	return found;
+}
+
+static bool pool_steal(struct pool *pool, unsigned int id)
+{
+	struct pool_range *victim, *own = &pool->ranges[id];
+	unsigned int i, n, head = 0, tail = 0;
+
+	for (i = 1; i < pool->nr_workers; i++) {
+		victim = &pool->ranges[(id + i) % pool->nr_workers];
+
+		pthread_mutex_lock(&victim->lock);
+		n = victim->tail - victim->head;
+		if (n) {
+			tail = victim->tail;
+			head = tail - DIV_ROUND_UP(n, 2);
+			victim->tail = head;
+		}
+		pthread_mutex_unlock(&victim->lock);
+
+		if (n) {
+			pthread_mutex_lock(&own->lock);
+			own->head = head;
+			own->tail = tail;
+			pthread_mutex_unlock(&own->lock);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void *pool_worker_run(void *arg)
+{
+	struct pool_worker *worker = arg;
+	struct pool *pool = worker->pool;
+	unsigned int task;
+
+	do {
+		while (pool_pop(&pool->ranges[worker->id], &task))
+			pool->fn(task, pool->arg);
+	} while (pool_steal(pool, worker->id));
+
+	return NULL;
+}
+
+/*
+ * Runs @fn(task, @arg) for every task in 0..@nr_tasks-1 on @nr_workers
+ * threads and waits for all of them to complete.
+ */
+int pool_run(unsigned int nr_tasks, unsigned int nr_workers,
+	     pool_fn fn, void *arg)
+{
+	struct pool_worker *workers;
+	struct pool pool;
+	unsigned int i, started;
+	int err;
+
+	if (!nr_tasks)
+		return 0;
+	if (!nr_workers)
+		nr_workers = pool_default_workers();
+	if (nr_workers > nr_tasks)
+		nr_workers = nr_tasks;
+
+	pool.nr_workers = nr_workers;
+	pool.fn = fn;
+	pool.arg = arg;
+	pool.ranges = calloc(nr_workers, sizeof(struct pool_range));
+	workers = calloc(nr_workers, sizeof(struct pool_worker));
+	if (!pool.ranges || !workers) {
+		err = -ENOMEM;
+		goto out;
+	}
+	err = 0;
+
+	for (i = 0; i < nr_workers; i++) {
+		pthread_mutex_init(&pool.ranges[i].lock, NULL);
+		pool.ranges[i].head = (unsigned long long) nr_tasks * i / nr_workers;
+		pool.ranges[i].tail = (unsigned long long) nr_tasks * (i + 1) / nr_workers;
+		workers[i].pool = &pool;
+		workers[i].id = i;
+	}
+
+	/* Worker 0 is the calling thread */
+	for (started = 1; started < nr_workers; started++) {
+		err = pthread_create(&workers[started].thread, NULL,
+				     pool_worker_run, &workers[started]);
+		if (err) {
+			fprintf(stderr, "failed to start worker: %s\n",
+				strerror(err));
+			err = 0;
+			break;
+		}
+	}
+
+	/* Tasks of workers that failed to start get stolen by the others */
+	pool_worker_run(&workers[0]);
+
+	for (i = 1; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	for (i = 0; i < nr_workers; i++)
+		pthread_mutex_destroy(&pool.ranges[i].lock);
+ out:
+	free(workers);
+	free(pool.ranges);
+	return err;
+}
@@ -0,0 +1,203 @@
+/*
+ * Per-driver capability and timing profiles
+ *
+ * How a driver keeps its survey counters, how long it lets us remain on
+ * a channel and how long remain on channel operations really take are
+ * properties of the driver and its firmware, not of a run. They are
+ * learned once and kept in a profile on disk, one per driver and firmware
+ * version, so later runs start with the right counter semantics and dwell
+ * parameters instead of learning them again.
+ *
+ * Profiles are small text files of key and value lines:
+ *
+ *	# acs-profile 1
+ *	counter_mode <enum counter_mode>
+ *	max_roc <ms>
+ *	roc_start <count> <mean> <M2>
+ *	roc_stop <count> <mean> <M2>
+ *	dwell_ratio <count> <mean> <M2>
+ *
+ * The timing statistics are mergeable so every run refines them. Keys
+ * that are not known, like the survey_attrs older versions kept, are
+ * skipped.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "acs.h"
+
+#define PROFILE_VERSION		1
+/* Effective dwells shorter than this fraction of the request get padded */
+#define PROFILE_SHORT_DWELL	0.9L
+/* Dwells timed before the effective dwell ratio is trusted */
+#define PROFILE_MIN_DWELLS	3
+
+/* Returns -ENAMETOOLONG if the path of the profile does not fit */
+int profile_init(struct driver_profile *prof, const char *dir,
+		 const char *driver, const char *fw_version)
+{
+	char *c;
+	int ret;
+
+	memset(prof, 0, sizeof(struct driver_profile));
+	chan_stats_init(&prof->roc_start);
+	chan_stats_init(&prof->roc_stop);
+	chan_stats_init(&prof->dwell_ratio);
+
+	ret = snprintf(prof->path, sizeof(prof->path), "%s/%s-%s.profile",
+		       dir, driver, fw_version[0] ? fw_version : "unknown");
+	if (ret < 0 || (size_t) ret >= sizeof(prof->path))
+		return -ENAMETOOLONG;
+
+	/* Firmware versions come with anything in them */
+	for (c = prof->path + strlen(dir) + 1; *c; c++)
+		if (*c == '/' || *c == ' ')
+			*c = '_';
+
+	return 0;
+}
+
+static void read_stats(const char *val, struct chan_stats *stats)
+{
+	unsigned long long count;
+
+	if (sscanf(val, "%llu %Lg %Lg", &count, &stats->mean, &stats->m2) == 3)
+		stats->count = count;
+}
+
+/* Returns 0 if a profile was loaded, -ENOENT if none was kept yet */
+int profile_load(struct driver_profile *prof)
+{
+	char line[256], key[32];
+	unsigned int val;
+	int version, pos;
+	FILE *fp;
+
+	fp = fopen(prof->path, "r");
+	if (!fp)
+		return -errno;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#') {
+			if (sscanf(line, "# acs-profile %d", &version) == 1 &&
+			    version != PROFILE_VERSION) {
+				fclose(fp);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (sscanf(line, "%31s %n", key, &pos) != 1)
+			continue;
+
+		if (strcmp(key, "counter_mode") == 0 &&
+			 sscanf(line + pos, "%u", &val) == 1)
+			prof->counter_mode = val;
+		else if (strcmp(key, "max_roc") == 0 &&
+			 sscanf(line + pos, "%u", &val) == 1)
+			prof->max_roc_duration = val;
+		else if (strcmp(key, "roc_start") == 0)
+			read_stats(line + pos, &prof->roc_start);
+		else if (strcmp(key, "roc_stop") == 0)
+			read_stats(line + pos, &prof->roc_stop);
+		else if (strcmp(key, "dwell_ratio") == 0)
+			read_stats(line + pos, &prof->dwell_ratio);
+	}
+
+	fclose(fp);
+	prof->loaded = true;
+	return 0;
+}
+
+static void write_stats(FILE *fp, const char *key, const struct chan_stats *stats)
+{
+	fprintf(fp, "%s %llu %.17Lg %.17Lg\n", key,
+		(unsigned long long) stats->count, stats->mean, stats->m2);
+}
+
+int profile_save(struct driver_profile *prof)
+{
+	char tmp[sizeof(prof->path) + 8], *slash;
+	FILE *fp;
+
+	slash = strrchr(prof->path, '/');
+	if (slash) {
+		*slash = '\0';
+		mkdir(prof->path, 0755);
+		*slash = '/';
+	}
+
+	/* Written aside and renamed so a concurrent run never reads half */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", prof->path);
+	fp = fopen(tmp, "w");
+	if (!fp)
+		return -errno;
+
+	fprintf(fp, "# acs-profile %d\n", PROFILE_VERSION);
+	fprintf(fp, "counter_mode %u\n", prof->counter_mode);
+	fprintf(fp, "max_roc %u\n", prof->max_roc_duration);
+	write_stats(fp, "roc_start", &prof->roc_start);
+	write_stats(fp, "roc_stop", &prof->roc_stop);
+	write_stats(fp, "dwell_ratio", &prof->dwell_ratio);
+
+	if (fclose(fp) || rename(tmp, prof->path)) {
+		unlink(tmp);
+		return -errno;
+	}
+	return 0;
+}
+
+/* Presets what the profile already knows about the driver in @ctx */
+void profile_apply(struct driver_profile *prof, struct acs_ctx *ctx)
+{
+	if (!prof->loaded)
+		return;
+
+	if (prof->counter_mode != COUNTERS_UNKNOWN)
+		ctx->counter_mode = prof->counter_mode;
+	if (prof->max_roc_duration)
+		ctx->max_roc_duration = prof->max_roc_duration;
+}
+
+/* Accounts the timing of a remain on channel operation that completed */
+void profile_observe_dwell(struct driver_profile *prof,
+			   const struct offchan_dwell *dwell)
+{
+	if (!dwell->started || !dwell->ended || dwell->cancelled ||
+	    !dwell->duration)
+		return;
+
+	chan_stats_add(&prof->roc_start,
+		       (long double) dwell->start - dwell->requested, 0);
+	chan_stats_add(&prof->roc_stop,
+		       (long double) dwell->end - (dwell->start + dwell->duration), 0);
+	chan_stats_add(&prof->dwell_ratio,
+		       (long double) (dwell->end - dwell->start) / dwell->duration, 0);
+}
+
+/* Keeps what this run learned about the driver */
+void profile_update(struct driver_profile *prof, struct acs_ctx *ctx)
+{
+	if (ctx->counter_mode != COUNTERS_UNKNOWN)
+		prof->counter_mode = ctx->counter_mode;
+	prof->max_roc_duration = ctx->max_roc_duration;
+}
+
+/*
+ * Duration to request to really remain on channel for @duration ms, on
+ * drivers known to end remain on channel operations early.
+ */
+unsigned int profile_dwell(const struct driver_profile *prof,
+			   unsigned int duration)
+{
+	if (prof->dwell_ratio.count < PROFILE_MIN_DWELLS ||
+	    prof->dwell_ratio.mean >= PROFILE_SHORT_DWELL ||
+	    prof->dwell_ratio.mean <= 0)
+		return duration;
+
+	return duration / prof->dwell_ratio.mean;
+}
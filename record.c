@@ -0,0 +1,213 @@
+/*
+ * Recording and loading of survey samples
+ *
+ * A sample record is a plain text file, one survey sample per line:
+ *
+ *	# acs-samples 1 dwell=60
+ *	<timestamp ms> <freq MHz> <noise dBm> <time> <busy> <rx> <tx>
+ *
+ * Records let the scoring code be re-run offline over data collected
+ * in the field. An optional index file lists one record per line along
+ * with the time range it covers so that a corpus can be filtered by
+ * time without opening every record:
+ *
+ *	<first timestamp ms> <last timestamp ms> <path>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "acs.h"
+
+#define RECORD_VERSION	1
+
+struct sample_record {
+	FILE *fp;
+	char *path;
+	__u64 first;
+	__u64 last;
+};
+
+__u64 wall_clock_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (__u64) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct sample_record *record_open(const char *path, unsigned int dwell)
+{
+	struct sample_record *rec;
+
+	rec = (struct sample_record *) malloc(sizeof(struct sample_record));
+	if (!rec)
+		return NULL;
+	memset(rec, 0, sizeof(struct sample_record));
+
+	rec->fp = fopen(path, "w");
+	if (!rec->fp) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		free(rec);
+		return NULL;
+	}
+
+	rec->path = strdup(path);
+	fprintf(rec->fp, "# acs-samples %d dwell=%u\n", RECORD_VERSION, dwell);
+
+	return rec;
+}
+
+void record_sample(struct sample_record *rec, const struct survey_sample *sample)
+{
+	if (!rec->first)
+		rec->first = sample->timestamp;
+	rec->last = sample->timestamp;
+
+	fprintf(rec->fp, "%llu %u %d %llu %llu %llu %llu\n",
+		(unsigned long long) sample->timestamp,
+		sample->center_freq,
+		sample->noise,
+		(unsigned long long) sample->channel_time,
+		(unsigned long long) sample->channel_time_busy,
+		(unsigned long long) sample->channel_time_rx,
+		(unsigned long long) sample->channel_time_tx);
+}
+
+static int record_add_index(struct sample_record *rec, const char *index_path)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	if (!rec->first)
+		return 0;
+
+	if (!realpath(rec->path, path)) {
+		fprintf(stderr, "failed to resolve %s: %s\n",
+			rec->path, strerror(errno));
+		return -errno;
+	}
+
+	fp = fopen(index_path, "a");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s: %s\n",
+			index_path, strerror(errno));
+		return -errno;
+	}
+
+	fprintf(fp, "%llu %llu %s\n",
+		(unsigned long long) rec->first,
+		(unsigned long long) rec->last,
+		path);
+	fclose(fp);
+
+	return 0;
+}
+
+int record_close(struct sample_record *rec, const char *index_path)
+{
+	int err = 0;
+
+	if (fclose(rec->fp))
+		err = -errno;
+	if (!err && index_path)
+		err = record_add_index(rec, index_path);
+
+	free(rec->path);
+	free(rec);
+
+	return err;
+}
+
+/*
+ * Calls @fn for every sample of the record at @path taken within
+ * [@from, @to], a @to of 0 means no upper bound. If @dwell is given it is
+ * set to the dwell time the record was taken with. Returns the number of
+ * samples passed to @fn or a negative error code.
+ */
+int record_for_each(const char *path, __u64 from, __u64 to,
+		    unsigned int *dwell, record_fn fn, void *arg)
+{
+	struct survey_sample sample;
+	unsigned long long ts, time, busy, rx, tx;
+	unsigned int freq, rec_dwell;
+	int noise, version;
+	char line[256];
+	unsigned int lineno = 0;
+	int loaded = 0;
+	int err;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (line[0] == '#') {
+			if (sscanf(line, "# acs-samples %d dwell=%u",
+				   &version, &rec_dwell) != 2)
+				continue;
+			if (version != RECORD_VERSION) {
+				fprintf(stderr, "%s: unsupported record version %d\n",
+					path, version);
+				loaded = -EINVAL;
+				break;
+			}
+			if (dwell)
+				*dwell = rec_dwell;
+			continue;
+		}
+
+		if (sscanf(line, "%llu %u %d %llu %llu %llu %llu",
+			   &ts, &freq, &noise, &time, &busy, &rx, &tx) != 7) {
+			fprintf(stderr, "%s:%u: malformed sample\n", path, lineno);
+			continue;
+		}
+
+		if (ts < from || (to && ts > to))
+			continue;
+
+		sample.timestamp = ts;
+		sample.center_freq = freq;
+		sample.noise = noise;
+		sample.channel_time = time;
+		sample.channel_time_busy = busy;
+		sample.channel_time_rx = rx;
+		sample.channel_time_tx = tx;
+
+		err = fn(&sample, arg);
+		if (err) {
+			loaded = err;
+			break;
+		}
+		loaded++;
+	}
+
+	fclose(fp);
+
+	return loaded;
+}
+
+static int record_load_sample(const struct survey_sample *sample, void *arg)
+{
+	return add_survey_sample((struct acs_ctx *) arg, 0, sample);
+}
+
+/* Loads the samples of a record into @ctx, see record_for_each() */
+int record_load(struct acs_ctx *ctx, const char *path, __u64 from, __u64 to)
+{
+	int loaded;
+
+	loaded = record_for_each(path, from, to, NULL, record_load_sample, ctx);
+	if (loaded > 0)
+		annotate_enabled_chans(ctx);
+
+	return loaded;
+}
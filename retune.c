@@ -0,0 +1,294 @@
+/*
+ * Retune cost aware channel ordering
+ *
+ * Hopping between bands costs more than hopping to the next channel over,
+ * the PLL has to settle and some devices recalibrate. How much more is up
+ * to the hardware, so the latency between asking the kernel to remain on
+ * a channel and the radio being there is measured for every transition
+ * taken and kept, smoothed, in a transition cost matrix. Transitions not
+ * measured yet are assumed to cost more the further apart the channels are.
+ *
+ * The radio goes back to the operating channel once a remain on channel
+ * operation is over, so when the survey dump flags one every transition
+ * starts from there and the order channels are visited in costs nothing.
+ * Only a radio with no operating channel stays where the last operation
+ * left it. For those, every round the channels to survey are put in the
+ * order of a cheap closed tour through the matrix, found with a nearest
+ * neighbour tour improved by 2-opt moves, the usual travelling salesman
+ * heuristics. A fixed order would sample each channel at the same point
+ * of every round, so the order is started one channel further along each
+ * round to spread the samples of every channel evenly over time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "acs.h"
+
+/* Weight given to a new latency measurement in the smoothed cost */
+#define RETUNE_EWMA_WEIGHT	0.25L
+/* Assumed cost in ms of an unmeasured transition per GHz of distance */
+#define RETUNE_PRIOR_PER_GHZ	1.0L
+#define RETUNE_MAX_PASSES	32
+/* Smallest improvement in ms a 2-opt move is taken for */
+#define RETUNE_MIN_GAIN		1e-6L
+
+struct retune_matrix *retune_alloc(void)
+{
+	struct retune_matrix *m;
+	unsigned int i, j;
+
+	m = malloc(sizeof(struct retune_matrix));
+	if (!m)
+		return NULL;
+	memset(m, 0, sizeof(struct retune_matrix));
+
+	for (i = 0; i < RETUNE_MAX_FREQS; i++)
+		for (j = 0; j < RETUNE_MAX_FREQS; j++)
+			m->cost[i][j] = -1;
+
+	return m;
+}
+
+void retune_free(struct retune_matrix *m)
+{
+	free(m);
+}
+
+static int retune_index(struct retune_matrix *m, __u16 freq, bool add)
+{
+	unsigned int i;
+
+	for (i = 0; i < m->nr; i++)
+		if (m->freqs[i] == freq)
+			return i;
+
+	if (!add || m->nr == RETUNE_MAX_FREQS)
+		return -1;
+
+	m->freqs[m->nr] = freq;
+	return m->nr++;
+}
+
+/* Returns the operating channel flagged by the last survey dump, 0 if none */
+__u16 retune_home(struct acs_ctx *ctx)
+{
+	struct freq_item *freq;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member)
+		if (freq->in_use)
+			return freq->center_freq;
+
+	return 0;
+}
+
+/* Accounts @latency ms it took to get from @from to @to */
+void retune_observe(struct retune_matrix *m, __u16 from, __u16 to,
+		    __u64 latency)
+{
+	int i, j;
+
+	i = retune_index(m, from, true);
+	j = retune_index(m, to, true);
+	if (i < 0 || j < 0)
+		return;
+
+	if (m->cost[i][j] < 0)
+		m->cost[i][j] = latency;
+	else
+		m->cost[i][j] += RETUNE_EWMA_WEIGHT * (latency - m->cost[i][j]);
+}
+
+long double retune_cost(struct retune_matrix *m, __u16 from, __u16 to)
+{
+	int i, j;
+
+	i = retune_index(m, from, false);
+	j = retune_index(m, to, false);
+	if (i >= 0 && j >= 0 && m->cost[i][j] >= 0)
+		return m->cost[i][j];
+
+	return RETUNE_PRIOR_PER_GHZ * (from > to ? from - to : to - from) / 1000;
+}
+
+/*
+ * Looks every channel up in the matrix once, the tour is then built on
+ * @table where table[a * nr + b] is the cost of going from @chans[a] to
+ * @chans[b].
+ */
+static long double *cost_table(struct retune_matrix *m,
+			       struct freq_item **chans, unsigned int nr)
+{
+	long double *table;
+	unsigned int a, b;
+	int *idx;
+
+	table = malloc(nr * nr * sizeof(long double));
+	idx = malloc(nr * sizeof(int));
+	if (!table || !idx) {
+		free(table);
+		free(idx);
+		return NULL;
+	}
+
+	for (a = 0; a < nr; a++)
+		idx[a] = retune_index(m, chans[a]->center_freq, false);
+
+	for (a = 0; a < nr; a++) {
+		for (b = 0; b < nr; b++) {
+			if (idx[a] >= 0 && idx[b] >= 0 &&
+			    m->cost[idx[a]][idx[b]] >= 0)
+				table[a * nr + b] = m->cost[idx[a]][idx[b]];
+			else
+				table[a * nr + b] =
+					retune_cost(m, chans[a]->center_freq,
+						    chans[b]->center_freq);
+		}
+	}
+
+	free(idx);
+	return table;
+}
+
+static inline long double edge(const long double *table, unsigned int nr,
+			       unsigned int from, unsigned int to)
+{
+	return table[from * nr + to];
+}
+
+static void reverse(unsigned int *tour, unsigned int i, unsigned int j)
+{
+	unsigned int tmp;
+
+	for (; i < j; i++, j--) {
+		tmp = tour[i];
+		tour[i] = tour[j];
+		tour[j] = tmp;
+	}
+}
+
+static void nearest_neighbour(const long double *table, unsigned int *tour,
+			      unsigned int nr)
+{
+	long double cost, best_cost;
+	unsigned int i, j, best, tmp;
+
+	for (i = 1; i < nr; i++) {
+		best = i;
+		best_cost = edge(table, nr, tour[i - 1], tour[i]);
+		for (j = i + 1; j < nr; j++) {
+			cost = edge(table, nr, tour[i - 1], tour[j]);
+			if (cost < best_cost) {
+				best = j;
+				best_cost = cost;
+			}
+		}
+		tmp = tour[i];
+		tour[i] = tour[best];
+		tour[best] = tmp;
+	}
+}
+
+/*
+ * fwd[k] is the cost of the path from tour[0] to tour[k], bwd[k] the cost
+ * of walking that same path backwards.
+ */
+static void path_sums(const long double *table, const unsigned int *tour,
+		      unsigned int nr, long double *fwd, long double *bwd)
+{
+	unsigned int k;
+
+	fwd[0] = bwd[0] = 0;
+	for (k = 0; k + 1 < nr; k++) {
+		fwd[k + 1] = fwd[k] + edge(table, nr, tour[k], tour[k + 1]);
+		bwd[k + 1] = bwd[k] + edge(table, nr, tour[k + 1], tour[k]);
+	}
+}
+
+/*
+ * Costs need not be symmetric, reversing tour[i..j] also turns every edge
+ * in it around. The path sums give the cost of the segment both ways, so
+ * a move is still scored exactly, in constant time.
+ */
+static void two_opt(const long double *table, unsigned int *tour,
+		    unsigned int nr, long double *fwd, long double *bwd)
+{
+	long double gain;
+	unsigned int i, j, prev, next, pass;
+	bool improved = true;
+
+	for (pass = 0; improved && pass < RETUNE_MAX_PASSES; pass++) {
+		improved = false;
+		path_sums(table, tour, nr, fwd, bwd);
+		for (i = 1; i + 1 < nr; i++) {
+			for (j = i + 1; j < nr; j++) {
+				prev = tour[i - 1];
+				next = tour[(j + 1) % nr];
+				gain = edge(table, nr, prev, tour[i]) +
+				       edge(table, nr, tour[j], next) +
+				       fwd[j] - fwd[i] -
+				       edge(table, nr, prev, tour[j]) -
+				       edge(table, nr, tour[i], next) -
+				       (bwd[j] - bwd[i]);
+				if (gain <= RETUNE_MIN_GAIN)
+					continue;
+				reverse(tour, i, j);
+				path_sums(table, tour, nr, fwd, bwd);
+				improved = true;
+			}
+		}
+	}
+}
+
+/*
+ * Fills @order with the channels to survey this round, in the order they
+ * should be visited in. Returns the number of channels, at most @max.
+ */
+unsigned int plan_round(struct acs_ctx *ctx, struct freq_item **order,
+			unsigned int max)
+{
+	struct retune_matrix *m = ctx->retune;
+	struct freq_item *freq, **chans;
+	long double *table = NULL, *sums = NULL;
+	unsigned int nr = 0, i, start, *tour;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (!freq->enabled || freq->dominated || nr == max)
+			continue;
+		/* Sampled without leaving it */
+		if (freq->in_use && ctx->params.in_use_hz)
+			continue;
+		order[nr++] = freq;
+	}
+
+	if (!m || nr < 3)
+		return nr;
+
+	chans = malloc(nr * sizeof(struct freq_item *));
+	tour = malloc(nr * sizeof(unsigned int));
+	if (!chans || !tour)
+		goto out;
+	memcpy(chans, order, nr * sizeof(struct freq_item *));
+	for (i = 0; i < nr; i++)
+		tour[i] = i;
+
+	/* From the operating channel every order costs the same */
+	if (!retune_home(ctx)) {
+		sums = malloc(2 * nr * sizeof(long double));
+		table = cost_table(m, order, nr);
+		if (!sums || !table)
+			goto out;
+		nearest_neighbour(table, tour, nr);
+		two_opt(table, tour, nr, sums, sums + nr);
+	}
+
+	start = m->round++ % nr;
+	for (i = 0; i < nr; i++)
+		order[i] = chans[tour[(start + i) % nr]];
+ out:
+	free(table);
+	free(sums);
+	free(tour);
+	free(chans);
+	return nr;
+}
@@ -0,0 +1,380 @@
+/*
+ * Survey scheduling
+ *
+ * Adaptive dwells: a channel whose busy ratio barely moves from one
+ * dwell to the next is known well enough after a short look, while a
+ * bursty channel needs a long one for its mean to mean anything. With
+ * --adaptive each dwell is sized from the spread of the busy ratios seen
+ * on the channel so far, between --min-dwell and --max-dwell, and while
+ * it lasts the survey counters are looked at every DWELL_POLL_MS so the
+ * dwell can be cancelled as soon as its busy ratio stops changing.
+ *
+ * Confidence driven sampling: with --confidence every channel gets an
+ * interval around its ranking factor from the Student t quantile for the
+ * dwells taken on it, see confidence_t(), with the spread of those dwells
+ * never taken below the step the factor is quantized in. A channel whose
+ * interval lies entirely above the one of the best channel is dominated
+ * and not surveyed any more, and once only the best channel is left the
+ * survey is over.
+ *
+ * Time budget: with --budget the survey has to be over by a deadline.
+ * Before every round the time left is split across the rounds still
+ * wanted and the channels still surveyed, after taking off the overhead
+ * every dwell was measured to cost on top of its time on channel. Dwells
+ * get shorter as the deadline nears, then rounds are dropped, and no
+ * dwell is started that would not end before the deadline.
+ *
+ * Freshness: what is known about a channel is as fresh as its newest
+ * sample, and stays fresh for a TTL that gets shorter the more its busy
+ * ratio varies, from --fresh-ttl for the steadiest channels down to an
+ * eighth of it. Once the survey is over further rounds only visit the
+ * channels gone stale, the longest overdue for their TTL first, so
+ * channels that barely change are not dwelled on over and over.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+#include "acs.h"
+
+/* Busy ratio standard deviation at which dwells get as long as allowed */
+#define DWELL_FULL_STDDEV	0.1L
+/* Busy ratio change between two looks below which a dwell has settled */
+#define DWELL_SETTLED_DELTA	0.02L
+
+static unsigned int max_dwell(struct acs_ctx *ctx)
+{
+	unsigned int dwell = ctx->params.max_dwell;
+
+	if (!dwell)
+		dwell = DWELL_MAX_FACTOR * ctx->params.dwell;
+	if (dwell > ctx->max_roc_duration)
+		dwell = ctx->max_roc_duration;
+	return dwell;
+}
+
+/* Time in ms to remain on @freq for its next dwell */
+unsigned int freq_dwell(struct acs_ctx *ctx, struct freq_item *freq)
+{
+	unsigned int lo = ctx->params.min_dwell, hi;
+	long double spread;
+
+	if (!ctx->params.adaptive)
+		return ctx->params.dwell < ctx->max_roc_duration ?
+			ctx->params.dwell : ctx->max_roc_duration;
+
+	hi = max_dwell(ctx);
+	if (lo > hi)
+		lo = hi;
+
+	/* Nothing known about the channel yet, take a good look */
+	if (freq->busy_stats.count < 2)
+		return hi;
+
+	spread = chan_stats_stddev(&freq->busy_stats) / DWELL_FULL_STDDEV;
+	if (spread > 1)
+		spread = 1;
+
+	return lo + (hi - lo) * spread;
+}
+
+void dwell_watch_init(struct dwell_watch *watch, struct acs_ctx *ctx)
+{
+	watch->min_dwell = ctx->params.min_dwell;
+	watch->last_ratio = -1;
+}
+
+/* Time in ms to wait before looking at a dwell @elapsed ms in */
+int dwell_watch_next(struct dwell_watch *watch, __u64 elapsed)
+{
+	if (elapsed < watch->min_dwell)
+		return watch->min_dwell - elapsed;
+	return DWELL_POLL_MS;
+}
+
+/* Whether the dwell can end given the counters it accumulated so far */
+bool dwell_watch_converged(struct dwell_watch *watch,
+			   const struct survey_sample *peek)
+{
+	long double ratio, last = watch->last_ratio;
+
+	ratio = survey_busy_ratio(peek);
+	watch->last_ratio = ratio;
+
+	if (ratio < 0 || last < 0)
+		return false;
+	/* Two looks at a handful of ms on channel agree by chance */
+	if (peek->channel_time < watch->min_dwell ||
+	    peek->channel_time < DWELL_POLL_MS)
+		return false;
+
+	return ratio - last < DWELL_SETTLED_DELTA &&
+	       last - ratio < DWELL_SETTLED_DELTA;
+}
+
+/* Probability a standard normal variable is below @x */
+long double normal_cdf(long double x)
+{
+	return 0.5L * erfcl(-x / sqrtl(2));
+}
+
+/* Standard normal quantile of @level, found by bisection */
+long double confidence_z(long double level)
+{
+	long double lo = 0, hi = 10, mid;
+	int i;
+
+	if (level <= 0.5)
+		return 0;
+
+	for (i = 0; i < 64; i++) {
+		mid = (lo + hi) / 2;
+		if (normal_cdf(mid) < level)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return (lo + hi) / 2;
+}
+
+/*
+ * Student t quantile of @level with @df degrees of freedom, from the
+ * Cornish-Fisher expansion around the normal quantile. Within a few
+ * percent of the exact value from two degrees of freedom up, and always
+ * wider than the normal one.
+ */
+long double confidence_t(long double level, unsigned int df)
+{
+	long double z = confidence_z(level), z2 = z * z;
+	long double n = df;
+
+	if (!df)
+		return z;
+
+	return z + z * (z2 + 1) / (4 * n) +
+		z * ((5 * z2 + 16) * z2 + 3) / (96 * n * n) +
+		z * (((3 * z2 + 19) * z2 + 17) * z2 - 15) / (384 * n * n * n);
+}
+
+/*
+ * Smallest step the interference factor of a dwell moves in. The busy
+ * part is a difference of integer log2()s and noise comes in whole dBm,
+ * so a handful of dwells often agree exactly and have no spread at all.
+ */
+static long double factor_step(const struct acs_params *params)
+{
+	long double coeff = fabsl(params->noise_coeff);
+
+	return coeff && coeff < 1 ? coeff : 1;
+}
+
+/*
+ * Interval the ranking factor of @freq, see freq_rank_factor(), lies in
+ * at the configured confidence. The spread of the dwells is never taken
+ * to be below the quantization step of the factor, and with --rank pNN
+ * the standard error is that of the sample quantile of a normal
+ * distribution. Returns false if too few dwells were taken on @freq for
+ * the interval to mean anything.
+ */
+bool freq_score_bounds(struct acs_ctx *ctx, struct freq_item *freq,
+		       long double *lo, long double *hi)
+{
+	struct chan_stats *stats = &freq->live_stats;
+	long double q = ctx->params.rank_quantile;
+	long double sd, se, zq, score;
+
+	if (stats->count < CONFIDENCE_MIN_DWELLS)
+		return false;
+
+	sd = chan_stats_stddev(stats);
+	if (sd < factor_step(&ctx->params))
+		sd = factor_step(&ctx->params);
+	se = sd / sqrtl(stats->count);
+
+	if (q) {
+		zq = confidence_z(q > 0.5 ? q : 1 - q);
+		se *= sqrtl(q * (1 - q) * 2 * M_PI) * expl(zq * zq / 2);
+	}
+
+	score = freq_rank_factor(ctx, freq);
+	se *= confidence_t(ctx->params.confidence, stats->count - 1);
+	*lo = score - se;
+	*hi = score + se;
+
+	return true;
+}
+
+/*
+ * Marks every channel that is worse than the best one with confidence as
+ * dominated. Returns the number of channels still worth surveying.
+ */
+unsigned int prune_dominated(struct acs_ctx *ctx)
+{
+	struct freq_item *freq, *best = NULL;
+	long double lo, hi, best_hi = 0, best_score = 0;
+	unsigned int left = 0;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (!freq->enabled || freq->dominated)
+			continue;
+		if (!freq_score_bounds(ctx, freq, &lo, &hi))
+			continue;
+		if (!best || (lo + hi) / 2 < best_score) {
+			best = freq;
+			best_hi = hi;
+			best_score = (lo + hi) / 2;
+		}
+	}
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (!freq->enabled || freq->dominated)
+			continue;
+		if (best && freq != best &&
+		    freq_score_bounds(ctx, freq, &lo, &hi) && lo > best_hi) {
+			freq->dominated = true;
+			acs_log(&ctx->log, LOG_INFO,
+				"%d MHz is worse than %d MHz with %Lg%% confidence, "
+				"no longer surveyed", freq->center_freq,
+				best->center_freq, ctx->params.confidence * 100);
+			continue;
+		}
+		left++;
+	}
+
+	return left;
+}
+
+/* Number of channels still surveyed */
+unsigned int count_active_freqs(struct acs_ctx *ctx)
+{
+	struct freq_item *freq;
+	unsigned int nr = 0;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member)
+		if (freq->enabled && !freq->dominated)
+			nr++;
+
+	return nr;
+}
+
+/* Time in ms expected to be spent on a dwell besides being on channel */
+static long double dwell_overhead(struct acs_ctx *ctx)
+{
+	if (ctx->overhead.count < 2)
+		return BUDGET_OVERHEAD_GUESS;
+
+	/* Err on the side of finishing in time */
+	return ctx->overhead.mean + chan_stats_stddev(&ctx->overhead);
+}
+
+/*
+ * Longest dwell on each of @nr channels that lets the @rounds_left rounds
+ * still wanted fit in the time left, or as many of them as fit with
+ * dwells of at least --min-dwell. Returns 0 if not even one round fits.
+ */
+unsigned int budget_round_dwell(struct acs_ctx *ctx, unsigned int nr,
+				unsigned int rounds_left)
+{
+	long double left, dwell;
+	__u64 now = monotonic_ms();
+	unsigned int rounds;
+
+	if (!nr || now >= ctx->deadline)
+		return 0;
+	left = ctx->deadline - now;
+
+	for (rounds = rounds_left; rounds >= 1; rounds--) {
+		dwell = (left / (nr * rounds) - dwell_overhead(ctx)) /
+			ctx->params.snapshots;
+		if (dwell >= ctx->params.min_dwell)
+			return dwell;
+	}
+
+	return 0;
+}
+
+/* Whether a dwell of @duration ms still ends before the deadline */
+bool budget_allows(struct acs_ctx *ctx, unsigned int duration)
+{
+	return monotonic_ms() + duration + dwell_overhead(ctx) <= ctx->deadline;
+}
+
+/* Accounts a dwell of @duration ms that took @elapsed ms all in all */
+void budget_account(struct acs_ctx *ctx, unsigned int duration, __u64 elapsed)
+{
+	chan_stats_add(&ctx->overhead,
+		       elapsed > duration ? elapsed - duration : 0, 0);
+}
+
+/*
+ * Time in ms the samples of @freq stay fresh for, 0 if too few were taken
+ * to tell how volatile it is.
+ */
+__u64 freq_ttl(struct acs_ctx *ctx, struct freq_item *freq)
+{
+	__u64 hi = (__u64) ctx->params.fresh_ttl * 1000;
+	__u64 lo = hi / FRESH_MIN_FRACTION;
+	long double spread;
+
+	if (freq->busy_stats.count < 2)
+		return 0;
+
+	spread = chan_stats_stddev(&freq->busy_stats) / FRESH_FULL_STDDEV;
+	if (spread > 1)
+		spread = 1;
+
+	return hi - (hi - lo) * spread;
+}
+
+/* How far past its TTL @freq is, in multiples of the TTL */
+static long double freq_overdue(struct acs_ctx *ctx, struct freq_item *freq,
+				__u64 now)
+{
+	__u64 ttl = freq_ttl(ctx, freq), last = freq->live_stats.last;
+
+	if (!ttl || !last)
+		return INFINITY;
+	if (now < last)
+		return 0;
+	return (long double) (now - last) / ttl;
+}
+
+/*
+ * Fills @order with the channels to survey whose samples went stale, the
+ * longest overdue first. Returns the number of channels, at most @max.
+ */
+unsigned int plan_stale(struct acs_ctx *ctx, struct freq_item **order,
+			unsigned int max)
+{
+	long double *overdue, due;
+	struct freq_item *freq;
+	__u64 now = wall_clock_ms();
+	unsigned int nr = 0, i;
+
+	overdue = malloc((max ? max : 1) * sizeof(long double));
+	if (!overdue)
+		return plan_round(ctx, order, max);
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (!freq->enabled || freq->dominated || nr == max)
+			continue;
+		if (freq->in_use && ctx->params.in_use_hz)
+			continue;
+		due = freq_overdue(ctx, freq, now);
+		if (due < 1)
+			continue;
+
+		/* Insertion sort, most overdue first */
+		for (i = nr++; i && overdue[i - 1] < due; i--) {
+			overdue[i] = overdue[i - 1];
+			order[i] = order[i - 1];
+		}
+		overdue[i] = due;
+		order[i] = freq;
+	}
+
+	free(overdue);
+	return nr;
+}
@@ -0,0 +1,448 @@
+/*
+ * Query service
+ *
+ * With --socket acs answers queries about the channels it surveys on a
+ * Unix socket, see acs_proto.h for the protocol. The ranking is rebuilt
+ * after every round and kept in memory, so queries never cost a survey
+ * and are answered straight away. Subscribers get the ranking pushed to
+ * them whenever the order of the channels changes.
+ *
+ * The listening socket and the clients sit in an epoll set of their own
+ * which the main loop polls on along with the survey session.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "acs.h"
+#include "acs_proto.h"
+
+#define SERVICE_MAX_CLIENTS	32
+#define SERVICE_MSG_MAX		(sizeof(struct acs_msg) + \
+				 sizeof(struct acs_ranking) + \
+				 ACS_PROTO_MAX_CHANS * sizeof(struct acs_chan_info))
+
+struct service_client {
+	int fd;
+	bool subscribed;
+};
+
+/**
+ * struct service - the query service
+ *
+ * @path: path the socket is bound to
+ * @lfd: listening socket
+ * @epfd: epoll set of @lfd and the clients
+ * @clients: clients connected, a free slot has an @fd of -1
+ * @generation: bumped every time the order of the channels changes
+ * @round: rounds surveyed for the ranking
+ * @nr: number of channels in @chans
+ * @chans: the ranking, best channel first
+ */
+struct service {
+	char path[108];
+	int lfd;
+	int epfd;
+	struct service_client clients[SERVICE_MAX_CLIENTS];
+	__u32 generation;
+	unsigned int round;
+	unsigned int nr;
+	struct acs_chan_info chans[ACS_PROTO_MAX_CHANS];
+};
+
+static struct service_client *service_client(struct service *svc, int fd)
+{
+	unsigned int i;
+
+	for (i = 0; i < SERVICE_MAX_CLIENTS; i++)
+		if (svc->clients[i].fd == fd)
+			return &svc->clients[i];
+
+	return NULL;
+}
+
+static void service_drop(struct service *svc, struct service_client *client)
+{
+	epoll_ctl(svc->epfd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+	client->fd = -1;
+	client->subscribed = false;
+}
+
+static int service_send(struct service_client *client, __u16 type, __u32 seq,
+			const void *payload, size_t len)
+{
+	char buf[SERVICE_MSG_MAX];
+	struct acs_msg *msg = (struct acs_msg *) buf;
+
+	msg->type = type;
+	msg->len = len;
+	msg->seq = seq;
+	memcpy(buf + sizeof(*msg), payload, len);
+
+	if (send(client->fd, buf, sizeof(*msg) + len,
+		 MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static int service_send_error(struct service_client *client, __u32 seq,
+			      int error)
+{
+	struct acs_error err = { .error = error };
+
+	return service_send(client, ACS_MSG_ERROR, seq, &err, sizeof(err));
+}
+
+static int service_send_ranking(struct service *svc,
+				struct service_client *client, __u32 seq)
+{
+	char buf[sizeof(struct acs_ranking) +
+		 ACS_PROTO_MAX_CHANS * sizeof(struct acs_chan_info)];
+	struct acs_ranking *ranking = (struct acs_ranking *) buf;
+
+	memset(ranking, 0, sizeof(*ranking));
+	ranking->generation = svc->generation;
+	ranking->round = svc->round;
+	ranking->nr = svc->nr;
+	memcpy(ranking->chans, svc->chans, svc->nr * sizeof(svc->chans[0]));
+
+	return service_send(client, ACS_MSG_RANKING, seq, buf,
+			    sizeof(*ranking) + svc->nr * sizeof(svc->chans[0]));
+}
+
+static int freq_band(__u16 freq)
+{
+	if (freq >= 2400 && freq < 2500)
+		return ACS_BAND_2GHZ;
+	if (freq >= 5150 && freq < 5925)
+		return ACS_BAND_5GHZ;
+	if (freq >= 5925 && freq <= 7125)
+		return ACS_BAND_6GHZ;
+	return -1;
+}
+
+/*
+ * First channel of the @width MHz wide block @freq is part of, following
+ * the channelization of each band, or 0 if there is none.
+ */
+static __u16 block_start(__u16 freq, int band, unsigned int width)
+{
+	unsigned int base;
+
+	if (width == 20)
+		return freq;
+
+	switch (band) {
+	case ACS_BAND_2GHZ:
+		/* Blocks overlap, a channel pairs with the one 20 MHz up */
+		return freq;
+	case ACS_BAND_5GHZ:
+		/* The upper band is offset from the lower ones by 5 MHz */
+		base = freq >= 5745 ? 5745 : 5180;
+		break;
+	case ACS_BAND_6GHZ:
+		base = 5955;
+		break;
+	default:
+		return 0;
+	}
+
+	if (freq < base)
+		return 0;
+	return base + (freq - base) / width * width;
+}
+
+/*
+ * Picks the block of @req->width MHz in @req->band whose channels have
+ * the lowest mean factor, with the best of them as the primary channel.
+ * Blocks not every channel of which was surveyed are left out.
+ */
+static int service_best(struct service *svc, const struct acs_best_req *req,
+			struct acs_best *best)
+{
+	unsigned int i, j, members, need = req->width / 20;
+	struct acs_chan_info *primary;
+	long double sum, mean, best_mean = 0;
+	__u16 start;
+
+	if (req->width != 20 && req->width != 40 && req->width != 80 &&
+	    req->width != 160)
+		return -EINVAL;
+	if (req->band == ACS_BAND_2GHZ && req->width > 40)
+		return -EINVAL;
+
+	memset(best, 0, sizeof(*best));
+
+	for (i = 0; i < svc->nr; i++) {
+		if (freq_band(svc->chans[i].freq) != req->band)
+			continue;
+		start = block_start(svc->chans[i].freq, req->band, req->width);
+		if (!start)
+			continue;
+
+		members = 0;
+		sum = 0;
+		primary = NULL;
+		for (j = 0; j < svc->nr; j++) {
+			/* 2.4 GHz channels overlap, a block is 20 MHz apart */
+			if (svc->chans[j].freq < start ||
+			    svc->chans[j].freq >= start + req->width ||
+			    (svc->chans[j].freq - start) % 20)
+				continue;
+			members++;
+			sum += svc->chans[j].factor;
+			if (!primary || svc->chans[j].factor < primary->factor)
+				primary = &svc->chans[j];
+		}
+		if (members != need)
+			continue;
+
+		mean = sum / members;
+		if (best->freq && mean >= best_mean)
+			continue;
+
+		best_mean = mean;
+		best->freq = primary->freq;
+		best->center = start + req->width / 2 - 10;
+		best->width = req->width;
+		best->factor = (__s32) llroundl(mean);
+	}
+
+	if (!best->freq)
+		return -ENOENT;
+
+	best->generation = svc->generation;
+	return 0;
+}
+
+static int service_request(struct service *svc, struct service_client *client,
+			   const struct acs_msg *msg, const void *payload)
+{
+	const struct acs_stats_req *stats;
+	struct acs_best best;
+	unsigned int i;
+	int err;
+
+	switch (msg->type) {
+	case ACS_MSG_BEST_REQ:
+		if (msg->len != sizeof(struct acs_best_req))
+			return service_send_error(client, msg->seq, -EINVAL);
+		err = service_best(svc, payload, &best);
+		if (err)
+			return service_send_error(client, msg->seq, err);
+		return service_send(client, ACS_MSG_BEST, msg->seq,
+				    &best, sizeof(best));
+	case ACS_MSG_RANKING_REQ:
+		return service_send_ranking(svc, client, msg->seq);
+	case ACS_MSG_STATS_REQ:
+		if (msg->len != sizeof(struct acs_stats_req))
+			return service_send_error(client, msg->seq, -EINVAL);
+		stats = payload;
+		for (i = 0; i < svc->nr; i++)
+			if (svc->chans[i].freq == stats->freq)
+				return service_send(client, ACS_MSG_STATS,
+						    msg->seq, &svc->chans[i],
+						    sizeof(svc->chans[i]));
+		return service_send_error(client, msg->seq, -ENOENT);
+	case ACS_MSG_SUBSCRIBE:
+	case ACS_MSG_UNSUBSCRIBE:
+		client->subscribed = msg->type == ACS_MSG_SUBSCRIBE;
+		return service_send(client, ACS_MSG_ACK, msg->seq, NULL, 0);
+	default:
+		return service_send_error(client, msg->seq, -EOPNOTSUPP);
+	}
+}
+
+static void service_accept(struct service *svc)
+{
+	struct service_client *client;
+	struct epoll_event ev;
+	int fd;
+
+	fd = accept4(svc->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	client = service_client(svc, -1);
+	if (!client) {
+		close(fd);
+		return;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(svc->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		close(fd);
+		return;
+	}
+
+	client->fd = fd;
+	client->subscribed = false;
+}
+
+static void service_read(struct service *svc, struct service_client *client)
+{
+	char buf[sizeof(struct acs_msg) + 64];
+	struct acs_msg *msg = (struct acs_msg *) buf;
+	ssize_t n;
+
+	n = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n <= 0) {
+		service_drop(svc, client);
+		return;
+	}
+
+	if (n < (ssize_t) sizeof(*msg) || msg->len != n - sizeof(*msg)) {
+		if (service_send_error(client, 0, -EINVAL))
+			service_drop(svc, client);
+		return;
+	}
+
+	if (service_request(svc, client, msg, buf + sizeof(*msg)))
+		service_drop(svc, client);
+}
+
+int service_open(struct service **service, const char *path)
+{
+	struct sockaddr_un addr;
+	struct epoll_event ev;
+	struct service *svc;
+	unsigned int i;
+	int err;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	svc = calloc(1, sizeof(*svc));
+	if (!svc)
+		return -ENOMEM;
+	for (i = 0; i < SERVICE_MAX_CLIENTS; i++)
+		svc->clients[i].fd = -1;
+	strcpy(svc->path, path);
+	svc->epfd = -1;
+
+	svc->lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (svc->lfd < 0) {
+		err = -errno;
+		free(svc);
+		return err;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	/* A socket left behind by an earlier run */
+	unlink(path);
+	if (bind(svc->lfd, (struct sockaddr *) &addr, sizeof(addr)) ||
+	    listen(svc->lfd, 8)) {
+		err = -errno;
+		goto out;
+	}
+
+	svc->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (svc->epfd < 0) {
+		err = -errno;
+		goto out;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = svc->lfd;
+	if (epoll_ctl(svc->epfd, EPOLL_CTL_ADD, svc->lfd, &ev)) {
+		err = -errno;
+		goto out;
+	}
+
+	*service = svc;
+	return 0;
+ out:
+	service_close(svc);
+	return err;
+}
+
+void service_close(struct service *svc)
+{
+	unsigned int i;
+
+	if (!svc)
+		return;
+
+	for (i = 0; i < SERVICE_MAX_CLIENTS; i++)
+		if (svc->clients[i].fd >= 0)
+			close(svc->clients[i].fd);
+	if (svc->epfd >= 0)
+		close(svc->epfd);
+	close(svc->lfd);
+	unlink(svc->path);
+	free(svc);
+}
+
+int service_fd(struct service *svc)
+{
+	return svc->epfd;
+}
+
+/* Accepts clients and answers their queries, never blocks */
+void service_dispatch(struct service *svc)
+{
+	struct epoll_event events[8];
+	struct service_client *client;
+	int nr, i;
+
+	nr = epoll_wait(svc->epfd, events, ARRAY_SIZE(events), 0);
+	for (i = 0; i < nr; i++) {
+		if (events[i].data.fd == svc->lfd) {
+			service_accept(svc);
+			continue;
+		}
+		client = service_client(svc, events[i].data.fd);
+		if (client)
+			service_read(svc, client);
+	}
+}
+
+/*
+ * Takes the @nr channels of @chans, best first, as the ranking after
+ * @round rounds and pushes it to the subscribers if the order of the
+ * channels changed.
+ */
+void service_update(struct service *svc, const struct acs_chan_info *chans,
+		    unsigned int nr, unsigned int round)
+{
+	unsigned int i;
+	bool changed;
+
+	if (nr > ACS_PROTO_MAX_CHANS)
+		nr = ACS_PROTO_MAX_CHANS;
+
+	changed = nr != svc->nr;
+	for (i = 0; !changed && i < nr; i++)
+		changed = chans[i].freq != svc->chans[i].freq;
+
+	svc->nr = nr;
+	svc->round = round;
+	memcpy(svc->chans, chans, nr * sizeof(chans[0]));
+
+	if (!changed)
+		return;
+
+	svc->generation++;
+	for (i = 0; i < SERVICE_MAX_CLIENTS; i++) {
+		if (svc->clients[i].fd < 0 || !svc->clients[i].subscribed)
+			continue;
+		if (service_send_ranking(svc, &svc->clients[i], 0))
+			service_drop(svc, &svc->clients[i]);
+	}
+}
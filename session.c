@@ -0,0 +1,1150 @@
+/*
+ * Survey sessions
+ *
+ * A session owns the netlink sockets, channel list and statistics of one
+ * device and runs the survey as a state machine driven by the caller's
+ * event loop rather than by sleeping. Everything the survey waits for,
+ * the next dwell fitting the duty cycle, a gap in the station traffic,
+ * the kernel starting or ending a remain on channel operation, the next
+ * look at the counters during a dwell, the next sample of the operating
+ * channel and the next round, is either the event socket or a timerfd,
+ * all of which sit in one epoll set the caller polls on.
+ *
+ * Requests to the kernel, like survey dumps, are still answered before
+ * dispatching returns, they never wait on the radio.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+
+#include "acs.h"
+
+enum session_phase {
+	/* no round in progress */
+	SESSION_IDLE,
+	/* next dwell held back until it fits the duty cycle */
+	SESSION_AIRTIME,
+	/* next dwell held back until the stations go quiet */
+	SESSION_TRAFFIC,
+	/* remain on channel requested, waiting for the kernel to start it */
+	SESSION_ROC,
+	/* on channel, waiting for the next look at the counters or the end */
+	SESSION_DWELL,
+	/* failed or closed, nothing more will happen */
+	SESSION_DEAD,
+};
+
+/**
+ * struct acs_session - one device being surveyed
+ *
+ * @nl: netlink session
+ * @ctx: channel list and statistics
+ * @cb: callbacks results go to
+ * @arg: passed on to @cb
+ * @ifname: interface surveyed
+ * @devidx: its interface index
+ * @record_path: record to open when the survey starts
+ * @index_path: index the record is added to once closed
+ * @interval: seconds between rounds once the survey is over, 0 for none
+ * @window: samples of each channel kept across those rounds
+ * @cache_dir: directory results are cached in
+ * @cache_ttl: seconds cached results are used for, 0 for no cache
+ * @cache_refresh: whether to ignore cached results
+ * @refresh_rounds: rounds surveyed on top of cached results, 0 for all
+ * @cache: file results of the device are cached in, empty if none
+ * @sampler: sampler of the operating channel, used with in_use_hz
+ * @profile: driver profile, used if @ctx.profile is set
+ * @epfd: epoll set of the descriptors below, handed to the caller
+ * @evfd: event socket
+ * @tfd: timer of the phase in progress
+ * @ufd: timer of the operating channel samples
+ * @ifd: timer of the rounds once the survey is over
+ * @phase: what the session is waiting for
+ * @surveyed: whether the survey is over
+ * @round: rounds surveyed so far
+ * @rounds: rounds the survey lasts at most
+ * @cached: whether the survey was answered from the cache alone
+ * @order: channels in the order they are visited this round
+ * @nr: number of channels in @order
+ * @pos: channel of @order being dwelled on
+ * @freq: that channel
+ * @dwell: ms to remain on @freq per snapshot
+ * @retries: times @freq was dwelled on again as its counters were stale
+ * @started: CLOCK_MONOTONIC time in ms work on the dwell started at
+ * @op: the remain on channel operation of the dwell
+ * @snap: next snapshot to take during the dwell
+ * @look: whether @tfd is for a look at the counters rather than the end
+ * @watch: state of an adaptive dwell
+ * @traffic_deadline: CLOCK_MONOTONIC time in ms to stop waiting for a gap
+ * @traffic_last: station bytes seen on the previous poll
+ * @traffic_polls: station polls done for the dwell
+ */
+struct acs_session {
+	struct nl80211_state nl;
+	struct acs_ctx ctx;
+	struct acs_callbacks cb;
+	void *arg;
+	char ifname[IFNAMSIZ];
+	int devidx;
+	const char *record_path;
+	const char *index_path;
+	unsigned int interval;
+	unsigned int window;
+	const char *cache_dir;
+	unsigned int cache_ttl;
+	bool cache_refresh;
+	unsigned int refresh_rounds;
+	char cache[4096];
+	struct in_use_sampler sampler;
+	struct driver_profile profile;
+	int epfd;
+	int evfd;
+	int tfd;
+	int ufd;
+	int ifd;
+	enum session_phase phase;
+	bool surveyed;
+	unsigned int round;
+	unsigned int rounds;
+	bool cached;
+	struct freq_item **order;
+	unsigned int nr;
+	unsigned int pos;
+	struct freq_item *freq;
+	unsigned int dwell;
+	unsigned int retries;
+	__u64 started;
+	struct offchan_dwell op;
+	unsigned int snap;
+	bool look;
+	struct dwell_watch watch;
+	__u64 traffic_deadline;
+	__u32 traffic_last;
+	unsigned int traffic_polls;
+};
+
+void acs_config_init(struct acs_config *config)
+{
+	memset(config, 0, sizeof(*config));
+	acs_params_init(&config->params);
+	config->profile_dir = PROFILE_DIR;
+	config->cache_dir = CACHE_DIR;
+}
+
+void acs_log(const struct acs_logger *log, int prio, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!log->fn)
+		return;
+
+	va_start(ap, fmt);
+	log->fn(prio, fmt, ap, log->arg);
+	va_end(ap);
+}
+
+int acs_session_fd(struct acs_session *s)
+{
+	return s->epfd;
+}
+
+static int get_ctl_fd(void)
+{
+	int fd;
+
+	fd = socket(PF_INET, SOCK_DGRAM, 0);
+	if (fd >= 0)
+		return fd;
+
+	fd = socket(PF_PACKET, SOCK_DGRAM, 0);
+	if (fd >= 0)
+		return fd;
+
+	fd = socket(PF_INET6, SOCK_DGRAM, 0);
+	if (fd >= 0)
+		return fd;
+
+	return -1;
+}
+
+
+static bool is_link_up(const char *devname)
+{
+	struct ifreq ifr;
+	int fd;
+	int err;
+
+	strncpy(ifr.ifr_name, devname, IFNAMSIZ);
+	fd = get_ctl_fd();
+	if (fd < 0)
+		return false;
+	err = ioctl(fd, SIOCGIFFLAGS, &ifr);
+	close(fd);
+	if (err)
+		return false;
+	if (ifr.ifr_flags & IFF_UP)
+		return true;
+
+	return false;
+}
+
+/* Gets the driver and firmware version behind @devname through ethtool */
+static int get_driver_info(const char *devname, char *driver, char *fw_version)
+{
+	struct ethtool_drvinfo drvinfo;
+	struct ifreq ifr;
+	int fd, err;
+
+	memset(&drvinfo, 0, sizeof(drvinfo));
+	drvinfo.cmd = ETHTOOL_GDRVINFO;
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, IFNAMSIZ, "%s", devname);
+	ifr.ifr_data = (void *) &drvinfo;
+
+	fd = get_ctl_fd();
+	if (fd < 0)
+		return -errno;
+	err = ioctl(fd, SIOCETHTOOL, &ifr);
+	close(fd);
+	if (err)
+		return -errno;
+
+	memcpy(driver, drvinfo.driver, sizeof(drvinfo.driver));
+	memcpy(fw_version, drvinfo.fw_version, sizeof(drvinfo.fw_version));
+	driver[sizeof(drvinfo.driver) - 1] = '\0';
+	fw_version[sizeof(drvinfo.fw_version) - 1] = '\0';
+
+	return 0;
+}
+
+static int epoll_add(int epfd, int fd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static int timer_add(int epfd)
+{
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0)
+		return -errno;
+	if (epoll_add(epfd, fd)) {
+		close(fd);
+		return -errno;
+	}
+
+	return fd;
+}
+
+static void ms_to_timespec(__u64 ms, struct timespec *ts)
+{
+	ts->tv_sec = ms / 1000;
+	ts->tv_nsec = (ms % 1000) * 1000000;
+}
+
+/* Fires @fd once at CLOCK_MONOTONIC time @when, in ms */
+static int timer_at(int fd, __u64 when)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	/* A zero time would disarm the timer rather than fire it */
+	ms_to_timespec(when ? when : 1, &its.it_value);
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL))
+		return -errno;
+
+	return 0;
+}
+
+/* Fires @fd every @period_ms ms from now on */
+static int timer_every(int fd, unsigned int period_ms)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	ms_to_timespec(period_ms, &its.it_value);
+	its.it_interval = its.it_value;
+	if (timerfd_settime(fd, 0, &its, NULL))
+		return -errno;
+
+	return 0;
+}
+
+int acs_session_open(struct acs_session **session,
+		     const struct acs_config *config,
+		     const struct acs_callbacks *cb, void *arg)
+{
+	char driver[32], fw_version[32];
+	struct acs_session *s;
+	int err;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+
+	acs_ctx_init(&s->ctx);
+	s->ctx.params = config->params;
+	if (cb)
+		s->cb = *cb;
+	s->arg = arg;
+	s->ctx.log.fn = s->nl.log.fn = s->cb.log;
+	s->ctx.log.arg = s->nl.log.arg = arg;
+	s->ctx.on_answer = s->cb.answer;
+	s->ctx.on_answer_arg = arg;
+	strncpy(s->ifname, config->ifname, IFNAMSIZ - 1);
+	s->record_path = config->record_path;
+	s->index_path = config->index_path;
+	s->interval = config->interval;
+	s->window = config->window ? config->window : config->params.rounds;
+	s->cache_dir = config->cache_dir;
+	s->cache_ttl = config->cache_ttl;
+	s->cache_refresh = config->cache_refresh;
+	s->refresh_rounds = config->refresh_rounds;
+	s->rounds = config->params.rounds;
+	s->epfd = s->tfd = s->ufd = s->ifd = -1;
+	s->phase = SESSION_IDLE;
+
+	s->devidx = if_nametoindex(s->ifname);
+	if (!s->devidx) {
+		free(s);
+		return -ENODEV;
+	}
+	if (!is_link_up(s->ifname)) {
+		free(s);
+		return -ENOLINK;
+	}
+
+	err = nl80211_init(&s->nl, config->debug);
+	if (err) {
+		free(s);
+		return err;
+	}
+
+	s->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (s->epfd < 0) {
+		err = -errno;
+		goto out;
+	}
+	s->evfd = nl_socket_get_fd(s->nl.ev_sock);
+	if (epoll_add(s->epfd, s->evfd)) {
+		err = -errno;
+		goto out;
+	}
+	s->tfd = err = timer_add(s->epfd);
+	if (err < 0)
+		goto out;
+	s->ufd = err = timer_add(s->epfd);
+	if (err < 0)
+		goto out;
+	s->ifd = err = timer_add(s->epfd);
+	if (err < 0)
+		goto out;
+
+	err = get_wiphy_index(&s->nl, s->devidx);
+	if (err)
+		goto out;
+
+	if (config->profile_dir &&
+	    !get_driver_info(s->ifname, driver, fw_version)) {
+		err = profile_init(&s->profile, config->profile_dir, driver,
+				   fw_version);
+		if (err)
+			goto out;
+		if (!profile_load(&s->profile))
+			profile_apply(&s->profile, &s->ctx);
+		s->ctx.profile = &s->profile;
+	}
+
+	if (!s->ctx.profile || !s->ctx.profile->max_roc_duration) {
+		err = get_wiphy_info(&s->nl, &s->ctx, s->devidx);
+		if (err)
+			goto out;
+	}
+
+	*session = s;
+	return 0;
+ out:
+	acs_session_close(s);
+	return err;
+}
+
+void acs_session_close(struct acs_session *s)
+{
+	struct acs_ctx *ctx;
+
+	if (!s)
+		return;
+	ctx = &s->ctx;
+
+	if (ctx->profile) {
+		profile_update(ctx->profile, ctx);
+		if (profile_save(ctx->profile))
+			acs_log(&ctx->log, LOG_ERR,
+				"failed to keep driver profile %s",
+				ctx->profile->path);
+	}
+	if (ctx->record)
+		record_close(ctx->record, s->index_path);
+	in_use_sampler_free(&s->nl);
+	nl80211_cleanup(&s->nl);
+	clean_freq_list(ctx);
+	retune_free(ctx->retune);
+	airtime_free(&ctx->airtime);
+
+	if (s->ifd >= 0)
+		close(s->ifd);
+	if (s->ufd >= 0)
+		close(s->ufd);
+	if (s->tfd >= 0)
+		close(s->tfd);
+	if (s->epfd >= 0)
+		close(s->epfd);
+	free(s->order);
+	free(s);
+}
+
+/*
+ * Ranks channels straight from the counters the driver accumulated before
+ * the session was opened, typically during its initial scan, without ever
+ * leaving the operating channel. @thin is set to the number of channels
+ * whose counters cover too little time for the ranking to be trusted, so
+ * the caller can start on the channel right away and refine its choice
+ * later. The answer is handed to the answer callback, flagged thin if
+ * any channel is.
+ */
+int acs_session_quick(struct acs_session *s, unsigned int *thin)
+{
+	struct acs_ctx *ctx = &s->ctx;
+	__u64 start = monotonic_ms();
+	int err;
+
+	err = call_survey_freq(&s->nl, ctx, s->devidx, 0);
+	if (err)
+		return err;
+	annotate_enabled_chans(ctx);
+	score_freq_list(ctx);
+	*thin = count_thin_freqs(ctx, QUICK_MIN_CHANNEL_TIME);
+
+	/* The counters tell how long they cover, not how recent that was */
+	if (*thin)
+		acs_log(&ctx->log, LOG_INFO,
+			"quick survey in %llu ms, thin coverage: %u channels "
+			"surveyed for less than %u ms",
+			(unsigned long long) (monotonic_ms() - start), *thin,
+			QUICK_MIN_CHANNEL_TIME);
+	else
+		acs_log(&ctx->log, LOG_INFO,
+			"quick survey in %llu ms, sufficient coverage",
+			(unsigned long long) (monotonic_ms() - start));
+
+	ctx->answer.thin = *thin > 0;
+	publish_answer(ctx, 0, true);
+
+	return 0;
+}
+
+/*
+ * Logs what the survey found so far: the surveys of every channel, the
+ * ranking and the time spent off channel.
+ */
+void acs_session_report(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+
+	if (ctx->params.budget && ctx->answer.freq)
+		acs_log(&ctx->log, LOG_INFO,
+			"used %llu of %u ms budget, %d MHz best with confidence %.2Lf",
+			(unsigned long long) (monotonic_ms() + ctx->params.budget -
+					      ctx->deadline),
+			ctx->params.budget, ctx->answer.freq,
+			ctx->answer.confidence);
+
+	parse_freq_list(ctx);
+	parse_freq_int_factor(ctx);
+	airtime_report(&ctx->airtime, &ctx->log);
+}
+
+/*
+ * Fills @chans with up to @max of the channels surveyed, best first, and
+ * returns how many it filled.
+ */
+unsigned int acs_session_ranking(struct acs_session *s,
+				 struct acs_chan_info *chans, unsigned int max)
+{
+	return ranking_build(&s->ctx, chans, max);
+}
+
+/* Exports the per channel statistics of the survey to @path */
+int acs_session_export(struct acs_session *s, const char *path)
+{
+	struct stats_table table;
+	int err;
+
+	memset(&table, 0, sizeof(table));
+	err = stats_table_from_ctx(&table, &s->ctx);
+	if (!err)
+		err = stats_table_export(path, &table);
+	stats_table_free(&table);
+
+	return err;
+}
+
+static int session_next_dwell(struct acs_session *s);
+
+/* Ends the survey, or a round of the ones that follow it */
+static void session_cache_save(struct acs_session *s)
+{
+	if (s->cache[0] && cache_save(&s->ctx, s->cache))
+		acs_log(&s->ctx.log, LOG_ERR,
+			"failed to cache survey results in %s", s->cache);
+}
+
+static int session_survey_over(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+	int err;
+
+	s->phase = SESSION_IDLE;
+	publish_answer(ctx, s->round, true);
+	s->surveyed = true;
+	if (!s->cached)
+		session_cache_save(s);
+
+	if (s->interval) {
+		/* A budget only bounds the initial survey */
+		ctx->params.budget = 0;
+		ctx->round_dwell = 0;
+		err = timer_every(s->ifd, s->interval * 1000);
+		if (err)
+			return err;
+	}
+
+	if (s->cb.done)
+		s->cb.done(0, s->arg);
+
+	return 0;
+}
+
+static int session_start_round(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+	struct freq_item *freq, **order;
+	unsigned int nr = 0;
+
+	if (!s->surveyed && ctx->params.budget) {
+		ctx->round_dwell = budget_round_dwell(ctx,
+						      count_active_freqs(ctx),
+						      s->rounds - s->round);
+		if (!ctx->round_dwell)
+			return session_survey_over(s);
+	}
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member)
+		nr++;
+	order = realloc(s->order, (nr ? nr : 1) * sizeof(struct freq_item *));
+	if (!order)
+		return -ENOMEM;
+	s->order = order;
+	if (s->surveyed && ctx->params.fresh_ttl)
+		s->nr = plan_stale(ctx, s->order, nr);
+	else
+		s->nr = plan_round(ctx, s->order, nr);
+	s->pos = 0;
+	s->retries = 0;
+
+	return session_next_dwell(s);
+}
+
+static int session_end_round(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+
+	s->round++;
+	s->phase = SESSION_IDLE;
+
+	if (s->surveyed) {
+		trim_freq_surveys(ctx, s->window);
+		publish_answer(ctx, s->round, false);
+		session_cache_save(s);
+		return 0;
+	}
+
+	if (ctx->params.confidence && prune_dominated(ctx) <= 1) {
+		acs_log(&ctx->log, LOG_INFO,
+			"best channel known with %Lg%% confidence after %u rounds",
+			ctx->params.confidence * 100, s->round);
+		return session_survey_over(s);
+	}
+	if (s->round >= s->rounds)
+		return session_survey_over(s);
+
+	publish_answer(ctx, s->round, false);
+	return session_start_round(s);
+}
+
+static int session_roc(struct acs_session *s)
+{
+	int err;
+
+	survey_dwell_start(s->freq);
+	s->nl.dwell = &s->op;
+	err = go_offchan_freq(&s->nl, &s->op);
+	if (err)
+		return err;
+
+	s->phase = SESSION_ROC;
+	return timer_at(s->tfd, s->op.requested + OFFCHAN_EVENT_TIMEOUT);
+}
+
+/*
+ * Starts the dwell once the stations associated go quiet for a moment, or
+ * after TRAFFIC_MAX_WAIT ms at the latest.
+ */
+static int session_poll_traffic(struct acs_session *s)
+{
+	struct station_traffic traffic;
+	int err;
+
+	err = get_station_traffic(&s->nl, s->devidx, &traffic);
+	if (err)
+		return err;
+	if (!traffic.stations ||
+	    (s->traffic_polls && traffic.bytes - s->traffic_last < TRAFFIC_IDLE_BYTES) ||
+	    monotonic_ms() >= s->traffic_deadline)
+		return session_roc(s);
+
+	s->traffic_last = traffic.bytes;
+	s->traffic_polls++;
+	s->phase = SESSION_TRAFFIC;
+	return timer_at(s->tfd, monotonic_ms() + TRAFFIC_POLL_MS);
+}
+
+static int session_airtime_ready(struct acs_session *s)
+{
+	if (!s->ctx.params.traffic_aware)
+		return session_roc(s);
+
+	s->traffic_deadline = monotonic_ms() + TRAFFIC_MAX_WAIT;
+	s->traffic_polls = 0;
+	return session_poll_traffic(s);
+}
+
+static int session_next_dwell(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+	unsigned int wait;
+	int err;
+
+	if (s->pos == s->nr)
+		return session_end_round(s);
+
+	/* The operating channel is sampled between dwells only */
+	err = sample_in_use(&s->nl);
+	if (err)
+		return err;
+
+	s->freq = s->order[s->pos];
+	if (!s->retries) {
+		s->dwell = freq_dwell(ctx, s->freq);
+		if (ctx->round_dwell && s->dwell > ctx->round_dwell)
+			s->dwell = ctx->round_dwell;
+	}
+	memset(&s->op, 0, sizeof(s->op));
+	s->op.ifidx = s->devidx;
+	s->op.freq = s->freq->center_freq;
+	s->op.duration = s->dwell * ctx->params.snapshots;
+	if (ctx->profile)
+		s->op.duration = profile_dwell(ctx->profile, s->op.duration);
+	if (s->op.duration > ctx->max_roc_duration)
+		s->op.duration = ctx->max_roc_duration;
+	s->started = monotonic_ms();
+
+	wait = airtime_wait(&ctx->airtime, &s->op.duration);
+
+	/*
+	 * The dwell has to end before the deadline however long it ends up
+	 * being padded for the driver and held back for the duty cycle and
+	 * the station traffic.
+	 */
+	if (ctx->params.budget &&
+	    !budget_allows(ctx, wait + s->op.duration +
+			   (ctx->params.traffic_aware ? TRAFFIC_MAX_WAIT : 0)))
+		return session_end_round(s);
+
+	if (wait) {
+		s->phase = SESSION_AIRTIME;
+		return timer_at(s->tfd, s->started + wait);
+	}
+
+	return session_airtime_ready(s);
+}
+
+/*
+ * Arms the timer of a dwell for the next look at the counters, the
+ * snapshots being evenly spread over the dwell and adaptive dwells looked
+ * at until their busy ratio settles, or else for giving up on the kernel
+ * ever ending the dwell.
+ */
+static int session_dwell_timer(struct acs_session *s)
+{
+	struct acs_params *params = &s->ctx.params;
+	__u64 now = monotonic_ms(), elapsed = now - s->op.start;
+
+	s->look = true;
+	if (params->snapshots > 1 && s->snap < params->snapshots)
+		return timer_at(s->tfd, s->op.start +
+				s->snap * (s->op.duration / params->snapshots));
+	if (params->snapshots == 1 && params->adaptive && !s->op.cancelled &&
+	    elapsed + DWELL_POLL_MS < s->op.duration)
+		return timer_at(s->tfd, now + dwell_watch_next(&s->watch, elapsed));
+
+	s->look = false;
+	return timer_at(s->tfd, s->op.start + s->op.duration +
+			OFFCHAN_EVENT_TIMEOUT);
+}
+
+static int session_look(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+	struct survey_sample peek;
+	int err;
+
+	if (ctx->params.snapshots > 1) {
+		err = call_survey_freq(&s->nl, ctx, s->devidx, s->op.freq);
+		if (err)
+			return err;
+		s->snap++;
+	} else {
+		err = peek_survey_freq(&s->nl, ctx, s->devidx, s->op.freq, &peek);
+		if (err)
+			return err;
+		/*
+		 * Counters not updated since the dwell started still hold
+		 * what they held before it, they tell nothing about it.
+		 */
+		if (peek.center_freq &&
+		    survey_peek_delta(ctx, s->freq, &peek) == SURVEY_DELTA_FRESH) {
+			if (dwell_watch_converged(&s->watch, &peek)) {
+				err = cancel_offchan(&s->nl, &s->op);
+				if (err)
+					return err;
+			}
+		}
+	}
+
+	return session_dwell_timer(s);
+}
+
+static int session_on_channel(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+	__u16 from;
+
+	if (ctx->retune) {
+		/* Between dwells the radio is back on the operating channel */
+		from = retune_home(ctx);
+		if (!from)
+			from = ctx->retune->last_freq;
+		if (from && s->op.start > s->op.requested)
+			retune_observe(ctx->retune, from, s->op.freq,
+				       s->op.start - s->op.requested);
+		ctx->retune->last_freq = s->op.freq;
+	}
+
+	s->phase = SESSION_DWELL;
+	s->snap = 1;
+	dwell_watch_init(&s->watch, ctx);
+
+	return session_dwell_timer(s);
+}
+
+static int session_dwell_over(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+	int err;
+
+	s->nl.dwell = NULL;
+	airtime_account(&ctx->airtime, s->op.start, s->op.end);
+	if (ctx->profile)
+		profile_observe_dwell(ctx->profile, &s->op);
+	err = call_survey_freq(&s->nl, ctx, s->devidx, s->op.freq);
+	if (err)
+		return err;
+	budget_account(ctx, s->dwell * ctx->params.snapshots,
+		       monotonic_ms() - s->started);
+
+	/*
+	 * Some drivers do not update the survey counters after a short
+	 * dwell, the sample is then dropped and we go back to that channel
+	 * right away for longer.
+	 */
+	if (s->freq->stale && s->retries < STALE_MAX_RETRIES) {
+		s->retries++;
+		s->dwell = s->dwell * 2 < ctx->max_roc_duration ?
+			s->dwell * 2 : ctx->max_roc_duration;
+		acs_log(&ctx->log, LOG_INFO,
+			"stale survey data on %d MHz, dwelling again for %ums",
+			s->freq->center_freq, s->dwell);
+	} else {
+		s->pos++;
+		s->retries = 0;
+	}
+
+	return session_next_dwell(s);
+}
+
+/*
+ * Takes a sample of every channel another application's scan visited,
+ * from the survey counters it left behind, at no airtime cost to us.
+ * Each visit is a dwell of its own as far as the counters go.
+ */
+static int session_harvest(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+	struct freq_item *freq;
+	unsigned int before = 0, after = 0;
+	int err;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		before += freq->survey_count;
+		/* Never left, its counters just went on */
+		if (!freq->in_use)
+			survey_dwell_start(freq);
+	}
+
+	err = call_survey_freq(&s->nl, ctx, s->devidx, 0);
+	if (err)
+		return err;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member)
+		after += freq->survey_count;
+	if (after == before)
+		return 0;
+
+	acs_log(&ctx->log, LOG_INFO,
+		"harvested %u samples left by another scan", after - before);
+	if (s->surveyed)
+		publish_answer(ctx, s->round, false);
+	return 0;
+}
+
+/* Drops @freq from the channels still to be dwelled on this round */
+static void session_drop_pending(struct acs_session *s, struct freq_item *freq)
+{
+	unsigned int i;
+
+	for (i = s->pos + 1; i < s->nr; i++) {
+		if (s->order[i] != freq)
+			continue;
+		memmove(&s->order[i], &s->order[i + 1],
+			(s->nr - i - 1) * sizeof(struct freq_item *));
+		s->nr--;
+		return;
+	}
+}
+
+/*
+ * Takes a sample of every channel another application remained on and
+ * left again, as if the dwell had been ours, and spares those channels
+ * our own dwell this round. A dwell held back for the duty cycle or the
+ * station traffic is skipped altogether if its channel got sampled.
+ */
+static int session_piggyback(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+	struct freq_item *freq;
+	bool pending = s->phase == SESSION_AIRTIME ||
+		       s->phase == SESSION_TRAFFIC || s->phase == SESSION_ROC;
+	bool skip = false;
+	unsigned int i, count;
+	int err;
+
+	for (i = 0; i < s->nl.nr_foreign; i++) {
+		freq = find_freq_item(ctx, s->nl.foreign[i]);
+		/* Remaining on the operating channel does not leave it */
+		if (!freq || !freq->enabled || freq->in_use)
+			continue;
+
+		count = freq->survey_count;
+		survey_dwell_start(freq);
+		err = call_survey_freq(&s->nl, ctx, s->devidx, freq->center_freq);
+		if (err)
+			return err;
+		if (freq->survey_count == count)
+			continue;
+
+		acs_log(&ctx->log, LOG_INFO,
+			"sampled %d MHz during another application's remain on channel",
+			freq->center_freq);
+		if (!pending)
+			continue;
+		session_drop_pending(s, freq);
+		if (freq == s->freq && s->phase != SESSION_ROC)
+			skip = true;
+	}
+	s->nl.nr_foreign = 0;
+
+	if (!skip)
+		return 0;
+	s->pos++;
+	s->retries = 0;
+	return session_next_dwell(s);
+}
+
+static int session_events(struct acs_session *s)
+{
+	int err;
+
+	offchan_process(&s->nl);
+
+	/*
+	 * Counters are only ever read between our dwells, mid dwell the
+	 * scan is left to the snapshots taken once the dwell is over.
+	 */
+	if (s->nl.scanned && s->phase != SESSION_DWELL) {
+		s->nl.scanned = false;
+		err = session_harvest(s);
+		if (err)
+			return err;
+	}
+	if (s->nl.nr_foreign && s->phase != SESSION_DWELL) {
+		err = session_piggyback(s);
+		if (err)
+			return err;
+	}
+
+	if (s->phase == SESSION_ROC && s->op.started) {
+		err = session_on_channel(s);
+		if (err)
+			return err;
+	}
+	if (s->phase == SESSION_DWELL && s->op.ended)
+		return session_dwell_over(s);
+
+	return 0;
+}
+
+/*
+ * The kernel never said our remain on channel operation started, or never
+ * said it ended, the event got lost or the driver dropped the operation.
+ * The operation is cancelled in case it is still on and the channel is
+ * skipped this round, a lost event is no reason to end the session.
+ */
+static int session_event_lost(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+
+	acs_log(&ctx->log, LOG_WARNING,
+		"no remain on channel event for %d MHz, skipping it this round",
+		s->op.freq);
+
+	/* If even that fails the kernel has long forgotten the operation */
+	cancel_offchan(&s->nl, &s->op);
+	s->nl.dwell = NULL;
+	if (s->op.started)
+		airtime_account(&ctx->airtime, s->op.start, monotonic_ms());
+
+	s->pos++;
+	s->retries = 0;
+	return session_next_dwell(s);
+}
+
+static int session_timer(struct acs_session *s)
+{
+	switch (s->phase) {
+	case SESSION_AIRTIME:
+		return session_airtime_ready(s);
+	case SESSION_TRAFFIC:
+		return session_poll_traffic(s);
+	case SESSION_ROC:
+		return session_event_lost(s);
+	case SESSION_DWELL:
+		if (!s->look)
+			return session_event_lost(s);
+		return session_look(s);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Answers from cached results if there are any fresh enough, or else
+ * surveys only the refresh rounds on top of as many cached rounds as
+ * make up a full survey. A forced refresh ignores them, the survey then
+ * replaces them once over.
+ */
+static int session_cache_load(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+	struct freq_item *freq;
+	struct wiphy_id id;
+	unsigned int most = 0, keep;
+	int loaded, err;
+
+	err = get_wiphy_id(&s->nl, s->devidx, &id);
+	if (err)
+		return err;
+	err = cache_path(s->cache, sizeof(s->cache), s->cache_dir, &id, ctx);
+	if (err)
+		return err;
+
+	if (s->cache_refresh)
+		return 0;
+	loaded = cache_load(ctx, s->cache, s->cache_ttl);
+	if (loaded <= 0)
+		return loaded;
+
+	if (s->refresh_rounds) {
+		keep = s->refresh_rounds < s->rounds ?
+			s->rounds - s->refresh_rounds : 0;
+		trim_freq_surveys(ctx, keep * ctx->params.snapshots);
+		s->rounds -= keep;
+		acs_log(&ctx->log, LOG_INFO,
+			"refreshing %u of %u rounds cached in %s",
+			s->rounds, ctx->params.rounds, s->cache);
+		return 0;
+	}
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member)
+		if (freq->survey_count > most)
+			most = freq->survey_count;
+	s->round = most / ctx->params.snapshots;
+	s->cached = true;
+	acs_log(&ctx->log, LOG_INFO, "answering from %s", s->cache);
+	return 0;
+}
+
+/*
+ * Gets the survey going, it then goes on as the session is dispatched.
+ * Fails with -EOPNOTSUPP if the device does not report the survey data
+ * needed.
+ */
+int acs_session_start(struct acs_session *s)
+{
+	struct acs_ctx *ctx = &s->ctx;
+	int err;
+
+	err = get_freq_list(&s->nl, ctx, s->devidx);
+	if (err)
+		return err;
+	ctx->answer.thin = false;
+
+	if ((ctx->survey_attrs & SURVEY_ATTRS_REQUIRED) != SURVEY_ATTRS_REQUIRED)
+		return -EOPNOTSUPP;
+
+	/* Only worth learning when there is more than one round to plan */
+	if (ctx->params.rounds > 1 && !ctx->retune)
+		ctx->retune = retune_alloc();
+
+	if (s->record_path && !ctx->record) {
+		ctx->record = record_open(s->record_path, ctx->params.dwell);
+		if (!ctx->record)
+			return -EIO;
+	}
+
+	if (ctx->params.in_use_hz && !s->nl.in_use) {
+		err = in_use_sampler_init(&s->nl, ctx, s->devidx, &s->sampler);
+		if (err)
+			return err;
+		err = timer_every(s->ufd, s->sampler.period);
+		if (err)
+			return err;
+	}
+
+	err = airtime_init(&ctx->airtime, ctx->params.duty_cycle,
+			   ctx->params.duty_window, ctx->params.min_dwell);
+	if (err)
+		return err;
+
+	err = nl80211_add_membership_mlme(&s->nl);
+	if (err)
+		return err;
+	err = nl80211_add_membership_scan(&s->nl);
+	if (err)
+		return err;
+
+	ctx->deadline = monotonic_ms() + ctx->params.budget;
+	if (s->cache_ttl) {
+		err = session_cache_load(s);
+		if (err)
+			return err;
+		if (s->cached)
+			return session_survey_over(s);
+	}
+
+	return session_start_round(s);
+}
+
+/*
+ * Does whatever the session has to do by now and returns without waiting
+ * for anything, to be called whenever acs_session_fd() is readable. On
+ * failure the session is dead, the done callback has been told and the
+ * error is returned.
+ */
+int acs_session_dispatch(struct acs_session *s)
+{
+	struct epoll_event events[4];
+	__u64 expirations;
+	int nr, i, fd, err = 0;
+
+	if (s->phase == SESSION_DEAD)
+		return 0;
+
+	nr = epoll_wait(s->epfd, events, ARRAY_SIZE(events), 0);
+	if (nr < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	/*
+	 * Events go first so a dwell that started or ended right before
+	 * its timer fired is not taken for one the kernel lost.
+	 */
+	for (i = 0; i < nr; i++)
+		if (events[i].data.fd == s->evfd)
+			err = session_events(s);
+
+	for (i = 0; i < nr && !err; i++) {
+		fd = events[i].data.fd;
+		if (fd == s->evfd)
+			continue;
+		/* Timers re-armed since the wait have nothing to read */
+		if (read(fd, &expirations, sizeof(expirations)) < 0)
+			continue;
+
+		if (fd == s->tfd) {
+			err = session_timer(s);
+		} else if (fd == s->ufd) {
+			if (s->phase != SESSION_ROC && s->phase != SESSION_DWELL)
+				err = sample_in_use(&s->nl);
+		} else if (fd == s->ifd) {
+			/* Missed rounds are not made up for */
+			if (s->phase == SESSION_IDLE)
+				err = session_start_round(s);
+		}
+	}
+
+	if (err) {
+		s->phase = SESSION_DEAD;
+		if (s->cb.done)
+			s->cb.done(err, s->arg);
+	}
+
+	return err;
+}
@@ -0,0 +1,116 @@
+/*
+ * Shared memory publication of the ranking
+ *
+ * With --shm the ranking is written after every round to a POSIX shared
+ * memory object readers map and copy out of without any system call, see
+ * acs_shm_read() in acs_proto.h. The object is guarded by a seqlock: the
+ * sequence number is odd while the ranking is being rewritten, readers
+ * that raced with the update just read again, and the writer never waits
+ * for any of them.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "acs.h"
+#include "acs_proto.h"
+
+/**
+ * struct shm_pub - shared memory object the ranking is published in
+ *
+ * @name: name of the object
+ * @shm: the object, mapped
+ */
+struct shm_pub {
+	char name[256];
+	struct acs_shm *shm;
+};
+
+int shm_pub_open(struct shm_pub **pub, const char *name)
+{
+	struct shm_pub *p;
+	int fd, err;
+
+	if (strlen(name) >= sizeof(p->name))
+		return -ENAMETOOLONG;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+	strcpy(p->name, name);
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		err = -errno;
+		free(p);
+		return err;
+	}
+
+	if (ftruncate(fd, sizeof(struct acs_shm))) {
+		err = -errno;
+		goto out;
+	}
+
+	p->shm = mmap(NULL, sizeof(struct acs_shm), PROT_READ | PROT_WRITE,
+		      MAP_SHARED, fd, 0);
+	if (p->shm == MAP_FAILED) {
+		err = -errno;
+		goto out;
+	}
+	close(fd);
+
+	/* Left even, readers of a stale object then see no channels */
+	memset(p->shm, 0, sizeof(*p->shm));
+	p->shm->version = ACS_PROTO_VERSION;
+	__atomic_store_n(&p->shm->magic, ACS_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	*pub = p;
+	return 0;
+ out:
+	close(fd);
+	shm_unlink(name);
+	free(p);
+	return err;
+}
+
+void shm_pub_close(struct shm_pub *pub)
+{
+	if (!pub)
+		return;
+
+	munmap(pub->shm, sizeof(*pub->shm));
+	shm_unlink(pub->name);
+	free(pub);
+}
+
+/* Publishes the @nr channels of @chans, best first, after @round rounds */
+void shm_publish(struct shm_pub *pub, const struct acs_chan_info *chans,
+		 unsigned int nr, unsigned int round)
+{
+	struct acs_shm *shm = pub->shm;
+	unsigned int i;
+	bool changed;
+
+	if (nr > ACS_PROTO_MAX_CHANS)
+		nr = ACS_PROTO_MAX_CHANS;
+
+	/* Only ever written here, reading it back needs no seqlock */
+	changed = nr != shm->ranking.nr;
+	for (i = 0; !changed && i < nr; i++)
+		changed = chans[i].freq != shm->chans[i].freq;
+
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if (changed)
+		shm->ranking.generation++;
+	shm->ranking.round = round;
+	shm->ranking.nr = nr;
+	memcpy(shm->chans, chans, nr * sizeof(chans[0]));
+
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+}
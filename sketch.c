@@ -0,0 +1,80 @@
+/*
+ * Fixed-size quantile sketches
+ *
+ * Both the busy ratio and the noise floor live in small bounded ranges,
+ * [0, 1] and a signed byte of dBm respectively, so a histogram of fixed
+ * width bins makes for a quantile sketch with a known error bound of half
+ * a bin, constant memory regardless of how long acs runs and O(1)
+ * updates. Sketches with the same layout also merge by adding up bins.
+ */
+
+#include <string.h>
+
+#include "acs.h"
+
+void sketch_init(struct quantile_sketch *sketch, long double lo, long double hi,
+		 unsigned int nr_bins)
+{
+	memset(sketch, 0, sizeof(struct quantile_sketch));
+
+	if (nr_bins > SKETCH_MAX_BINS)
+		nr_bins = SKETCH_MAX_BINS;
+	sketch->lo = lo;
+	sketch->width = (hi - lo) / nr_bins;
+	sketch->nr_bins = nr_bins;
+}
+
+void sketch_reset(struct quantile_sketch *sketch)
+{
+	sketch->count = 0;
+	memset(sketch->bins, 0, sizeof(sketch->bins));
+}
+
+void sketch_add(struct quantile_sketch *sketch, long double value)
+{
+	long bin;
+
+	bin = (value - sketch->lo) / sketch->width;
+	if (bin < 0)
+		bin = 0;
+	if (bin >= (long) sketch->nr_bins)
+		bin = sketch->nr_bins - 1;
+
+	sketch->bins[bin]++;
+	sketch->count++;
+}
+
+void sketch_merge(struct quantile_sketch *dst, const struct quantile_sketch *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < dst->nr_bins && i < src->nr_bins; i++)
+		dst->bins[i] += src->bins[i];
+	dst->count += src->count;
+}
+
+/*
+ * Returns the value below which a fraction @q of the values added fall,
+ * interpolating linearly within the bin it lands on.
+ */
+long double sketch_quantile(const struct quantile_sketch *sketch, long double q)
+{
+	long double rank, seen = 0;
+	unsigned int i;
+
+	if (!sketch->count)
+		return sketch->lo;
+
+	rank = q * sketch->count;
+
+	for (i = 0; i < sketch->nr_bins; i++) {
+		if (!sketch->bins[i])
+			continue;
+		if (seen + sketch->bins[i] >= rank)
+			return sketch->lo + sketch->width *
+				(i + (rank - seen) / sketch->bins[i]);
+		seen += sketch->bins[i];
+	}
+
+	return sketch->lo + sketch->width * sketch->nr_bins;
+}
@@ -0,0 +1,274 @@
+/*
+ * Mergeable per-channel statistics
+ *
+ * Channel statistics are kept as count, mean and sum of squared
+ * differences from the mean (M2) as per Welford's online algorithm. Two
+ * such aggregates can be merged exactly, as described by Chan et al,
+ * which lets statistics taken by many APs over many runs be reduced into
+ * a single profile in any order.
+ *
+ * Interference factors are kept against a 0 dBm noise floor rather than
+ * the lowest one of the survey they come from, so statistics of different
+ * sites and runs are on the same scale. They are exported one channel per
+ * line:
+ *
+ *	# acs-stats 2
+ *	<freq MHz> <count> <mean> <M2> <min> <max> <first ms> <last ms>
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acs.h"
+
+#define STATS_VERSION	2
+
+void chan_stats_init(struct chan_stats *stats)
+{
+	memset(stats, 0, sizeof(struct chan_stats));
+}
+
+void chan_stats_add(struct chan_stats *stats, long double value, __u64 timestamp)
+{
+	long double delta;
+
+	stats->count++;
+	delta = value - stats->mean;
+	stats->mean += delta / stats->count;
+	stats->m2 += delta * (value - stats->mean);
+
+	if (stats->count == 1 || value < stats->min)
+		stats->min = value;
+	if (stats->count == 1 || value > stats->max)
+		stats->max = value;
+
+	if (!stats->first || timestamp < stats->first)
+		stats->first = timestamp;
+	if (timestamp > stats->last)
+		stats->last = timestamp;
+}
+
+void chan_stats_merge(struct chan_stats *dst, const struct chan_stats *src)
+{
+	long double delta;
+	__u64 count;
+
+	if (!src->count)
+		return;
+	if (!dst->count) {
+		*dst = *src;
+		return;
+	}
+
+	count = dst->count + src->count;
+	delta = src->mean - dst->mean;
+	dst->m2 += src->m2 + delta * delta * dst->count * src->count / count;
+	dst->mean += delta * src->count / count;
+	dst->count = count;
+
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	if (src->first && (!dst->first || src->first < dst->first))
+		dst->first = src->first;
+	if (src->last > dst->last)
+		dst->last = src->last;
+}
+
+long double chan_stats_variance(const struct chan_stats *stats)
+{
+	if (stats->count < 2)
+		return 0;
+	return stats->m2 / (stats->count - 1);
+}
+
+long double chan_stats_stddev(const struct chan_stats *stats)
+{
+	return sqrtl(chan_stats_variance(stats));
+}
+
+struct chan_stats *stats_table_get(struct stats_table *table, __u16 freq)
+{
+	struct stats_table_entry *entries;
+	unsigned int i;
+
+	for (i = 0; i < table->nr; i++)
+		if (table->entries[i].freq == freq)
+			return &table->entries[i].stats;
+
+	entries = realloc(table->entries, (table->nr + 1) * sizeof(*entries));
+	if (!entries)
+		return NULL;
+	table->entries = entries;
+	table->entries[table->nr].freq = freq;
+	chan_stats_init(&table->entries[table->nr].stats);
+
+	return &table->entries[table->nr++].stats;
+}
+
+int stats_table_merge(struct stats_table *dst, const struct stats_table *src)
+{
+	struct chan_stats *stats;
+	unsigned int i;
+
+	for (i = 0; i < src->nr; i++) {
+		stats = stats_table_get(dst, src->entries[i].freq);
+		if (!stats)
+			return -ENOMEM;
+		chan_stats_merge(stats, &src->entries[i].stats);
+	}
+
+	return 0;
+}
+
+/*
+ * Collects the statistics of the scored frequencies of @ctx. They are
+ * scored against the lowest noise floor of @ctx, which moving to a 0 dBm
+ * floor shifts every factor by the same amount, the spread stays.
+ */
+int stats_table_from_ctx(struct stats_table *table, struct acs_ctx *ctx)
+{
+	long double shift = ctx->params.noise_coeff * ctx->lowest_noise;
+	struct freq_item *freq;
+	struct chan_stats *stats, rebased;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (!freq->enabled || !freq->stats.count)
+			continue;
+		stats = stats_table_get(table, freq->center_freq);
+		if (!stats)
+			return -ENOMEM;
+		rebased = freq->stats;
+		rebased.mean += shift;
+		rebased.min += shift;
+		rebased.max += shift;
+		chan_stats_merge(stats, &rebased);
+	}
+
+	return 0;
+}
+
+void stats_table_free(struct stats_table *table)
+{
+	free(table->entries);
+	table->entries = NULL;
+	table->nr = 0;
+}
+
+static int stats_entry_cmp(const void *a, const void *b)
+{
+	const struct stats_table_entry *ea = a, *eb = b;
+
+	return ea->freq - eb->freq;
+}
+
+void stats_table_write(FILE *fp, struct stats_table *table)
+{
+	struct stats_table_entry *entry;
+	unsigned int i;
+
+	qsort(table->entries, table->nr, sizeof(*entry), stats_entry_cmp);
+
+	fprintf(fp, "# acs-stats %d\n", STATS_VERSION);
+	for (i = 0; i < table->nr; i++) {
+		entry = &table->entries[i];
+		fprintf(fp, "%u %llu %.17Lg %.17Lg %.17Lg %.17Lg %llu %llu\n",
+			entry->freq,
+			(unsigned long long) entry->stats.count,
+			entry->stats.mean,
+			entry->stats.m2,
+			entry->stats.min,
+			entry->stats.max,
+			(unsigned long long) entry->stats.first,
+			(unsigned long long) entry->stats.last);
+	}
+}
+
+int stats_table_export(const char *path, struct stats_table *table)
+{
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	stats_table_write(fp, table);
+
+	if (fclose(fp))
+		return -errno;
+	return 0;
+}
+
+/* Returns true if the file at @path is a statistics export */
+bool stats_file_is_export(const char *path)
+{
+	char line[64];
+	bool ret = false;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return false;
+	if (fgets(line, sizeof(line), fp))
+		ret = strncmp(line, "# acs-stats ", 12) == 0;
+	fclose(fp);
+
+	return ret;
+}
+
+int stats_table_read(struct stats_table *table, const char *path)
+{
+	struct chan_stats entry, *stats;
+	unsigned long long count, first, last;
+	unsigned int freq, lineno = 0;
+	char line[512];
+	int version, err = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (line[0] == '#') {
+			if (sscanf(line, "# acs-stats %d", &version) == 1 &&
+			    version != STATS_VERSION) {
+				fprintf(stderr, "%s: unsupported stats version %d\n",
+					path, version);
+				err = -EINVAL;
+				break;
+			}
+			continue;
+		}
+
+		chan_stats_init(&entry);
+		if (sscanf(line, "%u %llu %Lg %Lg %Lg %Lg %llu %llu",
+			   &freq, &count, &entry.mean, &entry.m2,
+			   &entry.min, &entry.max, &first, &last) != 8) {
+			fprintf(stderr, "%s:%u: malformed stats\n", path, lineno);
+			continue;
+		}
+		entry.count = count;
+		entry.first = first;
+		entry.last = last;
+
+		stats = stats_table_get(table, freq);
+		if (!stats) {
+			err = -ENOMEM;
+			break;
+		}
+		chan_stats_merge(stats, &entry);
+	}
+
+	fclose(fp);
+	return err;
+}
@@ -2,6 +2,9 @@
 #include <errno.h>
 #include <string.h>
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
 
 #include <netlink/genl/genl.h>
 #include <netlink/genl/family.h>
@@ -12,13 +15,6 @@
 #include "nl80211.h"
 #include "acs.h"
 
-struct dl_list freq_list = {
-	(&freq_list),
-	(&freq_list),
-};
-
-__s8 lowest_noise = 100;
-
 /**
  * struct survey_info - channel survey info
  *
@@ -104,6 +100,7 @@ __s8 lowest_noise = 100;
  *	[1] http://en.wikipedia.org/wiki/Near_and_far_field
  */
 struct freq_survey {
+	__u64 timestamp;
 	__u32 ifidx;
 	__u16 center_freq;
 	__u64 channel_time;
@@ -116,28 +113,101 @@ struct freq_survey {
 	struct dl_list list_member;
 };
 
-static struct freq_item *get_freq_item(__u16 center_freq)
+void acs_ctx_init(struct acs_ctx *ctx)
+{
+	memset(ctx, 0, sizeof(struct acs_ctx));
+	dl_list_init(&ctx->freq_list);
+	ctx->lowest_noise = 100;
+	ctx->max_roc_duration = ROC_MAX_DURATION;
+	acs_params_init(&ctx->params);
+}
+
+struct freq_item *find_freq_item(struct acs_ctx *ctx, __u16 center_freq)
 {
 	struct freq_item *freq;
 
-	dl_list_for_each(freq, &freq_list, struct freq_item, list_member) {
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
 		if (freq->center_freq == center_freq)
 			return freq;
 	}
 
+	return NULL;
+}
+
+static struct freq_item *get_freq_item(struct acs_ctx *ctx, __u16 center_freq)
+{
+	struct freq_item *freq;
+
+	freq = find_freq_item(ctx, center_freq);
+	if (freq)
+		return freq;
+
 	freq = (struct freq_item*) malloc(sizeof(struct freq_item));
 	if (!freq)
 		return NULL;
 	memset(freq, 0, sizeof(struct freq_item));
 
 	freq->center_freq = center_freq;
+	/* Any noise floor seen replaces these */
+	freq->max_noise = -128;
+	freq->min_noise = 127;
 	dl_list_init(&freq->survey_list);
-	dl_list_add_tail(&freq_list, &freq->list_member);
+	sketch_init(&freq->busy_sketch, 0, 1, BUSY_SKETCH_BINS);
+	sketch_init(&freq->noise_sketch, -128, 128, 256);
+	chan_stats_init(&freq->busy_stats);
+	chan_stats_init(&freq->live_stats);
+	dl_list_add_tail(&ctx->freq_list, &freq->list_member);
 
 	return freq;
 }
 
-static int add_survey(struct nlattr **sinfo, __u32 ifidx)
+/*
+ * Fraction of the time not spent transmitting that the channel was found
+ * busy, or a negative value if the sample does not tell.
+ */
+long double survey_busy_ratio(const struct survey_sample *sample)
+{
+	if (sample->channel_time <= sample->channel_time_tx ||
+	    sample->channel_time_busy < sample->channel_time_tx)
+		return -1;
+
+	return (long double) (sample->channel_time_busy - sample->channel_time_tx) /
+		(sample->channel_time - sample->channel_time_tx);
+}
+
+/* Folds @sample into the noise floors, sketches and statistics of @freq */
+static void account_sample(struct acs_ctx *ctx, struct freq_item *freq,
+			   const struct survey_sample *sample)
+{
+	long double ratio;
+
+	if (freq->max_noise < sample->noise)
+		freq->max_noise = sample->noise;
+
+	if (freq->min_noise > sample->noise)
+		freq->min_noise = sample->noise;
+
+	if (ctx->lowest_noise > sample->noise)
+		ctx->lowest_noise = sample->noise;
+
+	ratio = survey_busy_ratio(sample);
+	if (ratio >= 0) {
+		sketch_add(&freq->busy_sketch, ratio);
+		chan_stats_add(&freq->busy_stats, ratio, sample->timestamp);
+	}
+	sketch_add(&freq->noise_sketch, sample->noise);
+	/*
+	 * The noise floor only shifts every channel's factor by the same
+	 * amount, so the live one can be computed before the lowest noise
+	 * floor is known and still compare channels the same way.
+	 */
+	chan_stats_add(&freq->live_stats,
+		       interference_factor(&ctx->params, sample, 0),
+		       sample->timestamp);
+}
+
+int add_survey_sample(struct acs_ctx *ctx, __u32 ifidx,
+		      const struct survey_sample *sample)
 {
 	struct freq_survey *survey;
 	struct freq_item *freq;
@@ -147,50 +217,93 @@ static int add_survey(struct nlattr **sinfo, __u32 ifidx)
 		return -ENOMEM;
 	memset(survey, 0, sizeof(struct freq_survey));
 
+	survey->timestamp = sample->timestamp;
 	survey->ifidx = ifidx;
-	survey->noise = (int8_t) nla_get_u8(sinfo[NL80211_SURVEY_INFO_NOISE]);
-	survey->center_freq = nla_get_u32(sinfo[NL80211_SURVEY_INFO_FREQUENCY]);
-	survey->channel_time = nla_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME]);
-	survey->channel_time_busy = nla_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_BUSY]);
-	survey->channel_time_rx = nla_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_RX]);
-	survey->channel_time_tx = nla_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_TX]);
-
-	freq = get_freq_item(survey->center_freq);
+	survey->noise = sample->noise;
+	survey->center_freq = sample->center_freq;
+	survey->channel_time = sample->channel_time;
+	survey->channel_time_busy = sample->channel_time_busy;
+	survey->channel_time_rx = sample->channel_time_rx;
+	survey->channel_time_tx = sample->channel_time_tx;
+
+	freq = get_freq_item(ctx, survey->center_freq);
 	if (!freq) {
 		free(survey);
 		return -ENOMEM;
 	}
 
-	if (freq->max_noise < survey->noise)
-		freq->max_noise = survey ->noise;
-
-	if (freq->min_noise > survey->noise)
-		freq->min_noise = survey->noise;
-
-	if (lowest_noise > survey->noise)
-		lowest_noise = survey->noise;
+	account_sample(ctx, freq, sample);
 
 	dl_list_add_tail(&freq->survey_list, &survey->list_member);
 	freq->survey_count++;
 
+	if (ctx->record)
+		record_sample(ctx->record, sample);
+
 	return 0;
 }
 
-static int check_survey(struct nlattr **sinfo, int freq_filter)
+static void parse_survey_sample(struct nlattr **sinfo,
+				struct survey_sample *sample)
 {
+	sample->timestamp = wall_clock_ms();
+	sample->noise = (int8_t) nla_get_u8(sinfo[NL80211_SURVEY_INFO_NOISE]);
+	sample->center_freq = nla_get_u32(sinfo[NL80211_SURVEY_INFO_FREQUENCY]);
+	sample->channel_time = nla_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME]);
+	sample->channel_time_busy = nla_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_BUSY]);
+	sample->channel_time_rx = nla_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_RX]);
+	sample->channel_time_tx = nla_get_u64(sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_TX]);
+}
+
+static int add_survey(struct acs_ctx *ctx, struct nlattr **sinfo, __u32 ifidx,
+		      int freq_filter)
+{
+	struct survey_sample sample;
 	struct freq_item *freq;
-	__u32 surveyed_freq;
+	enum survey_delta_ret ret;
+
+	parse_survey_sample(sinfo, &sample);
+
+	freq = get_freq_item(ctx, sample.center_freq);
+	if (!freq)
+		return -ENOMEM;
+
+	/*
+	 * Snapshots of all channels are kept current, not just the one
+	 * asked for, so time other applications spend on a channel is not
+	 * later credited to one of our dwells.
+	 */
+	ret = survey_delta(ctx, freq, &sample);
+
+	if (freq_filter && freq_filter != sample.center_freq)
+		return 0;
+
+	/* Counters that did not advance would only dilute the others */
+	freq->stale = ret == SURVEY_DELTA_STALE;
+	if (freq->stale)
+		return 0;
+
+	return add_survey_sample(ctx, ifidx, &sample);
+}
+
+static int check_survey(struct acs_ctx *ctx, struct nlattr **sinfo)
+{
+	struct freq_item *freq;
+	int i;
 
 	if (!sinfo[NL80211_SURVEY_INFO_FREQUENCY]) {
-		fprintf(stderr, "bogus frequency!\n");
+		acs_log(&ctx->log, LOG_WARNING, "bogus frequency!");
 		return NL_SKIP;
 	}
 
-	surveyed_freq = nla_get_u32(sinfo[NL80211_SURVEY_INFO_FREQUENCY]);
+	for (i = 0; i <= NL80211_SURVEY_INFO_MAX; i++)
+		if (sinfo[i])
+			ctx->survey_attrs |= BIT(i);
 
-	freq = get_freq_item(nla_get_u32(sinfo[NL80211_SURVEY_INFO_FREQUENCY]));
+	freq = get_freq_item(ctx, nla_get_u32(sinfo[NL80211_SURVEY_INFO_FREQUENCY]));
 	if (!freq)
 		return -ENOMEM;
+	freq->in_use = !!sinfo[NL80211_SURVEY_INFO_IN_USE];
 
 	if (!sinfo[NL80211_SURVEY_INFO_NOISE] ||
 	    !sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME] ||
@@ -198,13 +311,6 @@ static int check_survey(struct nlattr **sinfo, int freq_filter)
 	    !sinfo[NL80211_SURVEY_INFO_CHANNEL_TIME_TX])
 		return NL_SKIP;
 
-	if (freq_filter) {
-		if (freq_filter == -1)
-			return NL_SKIP;
-		if (freq_filter != surveyed_freq)
-			return NL_SKIP;
-	}
-
 	return 0;
 }
 
@@ -213,9 +319,8 @@ int handle_survey_dump(struct nl_msg *msg, void *arg)
 	struct nlattr *tb[NL80211_ATTR_MAX + 1];
 	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
 	struct nlattr *sinfo[NL80211_SURVEY_INFO_MAX + 1];
+	struct survey_req *req = arg;
 	__u32 ifidx;
-	int freq;
-	int *pfreq = NULL;
 	int err;
 
 	static struct nla_policy survey_policy[NL80211_SURVEY_INFO_MAX + 1] = {
@@ -223,35 +328,43 @@ int handle_survey_dump(struct nl_msg *msg, void *arg)
 		[NL80211_SURVEY_INFO_NOISE] = { .type = NLA_U8 },
 	};
 
-	if (!arg)
-		freq = 0;
-	else {
-		pfreq = (int *) arg;
-		freq = *pfreq;
-	}
-
 	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
 		  genlmsg_attrlen(gnlh, 0), NULL);
 
 	ifidx = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
 
 	if (!tb[NL80211_ATTR_SURVEY_INFO]) {
-		fprintf(stderr, "survey data missing!\n");
+		acs_log(&req->ctx->log, LOG_WARNING, "survey data missing!");
 		return NL_SKIP;
 	}
 
 	if (nla_parse_nested(sinfo, NL80211_SURVEY_INFO_MAX,
 			     tb[NL80211_ATTR_SURVEY_INFO],
 			     survey_policy)) {
-		fprintf(stderr, "failed to parse nested attributes!\n");
+		acs_log(&req->ctx->log, LOG_WARNING,
+			"failed to parse nested attributes!");
 		return NL_SKIP;
 	}
 
-	err = check_survey(sinfo, freq);
+	err = check_survey(req->ctx, sinfo);
 	if (err != 0)
 		return err;
 
-	add_survey(sinfo, ifidx);
+	if (req->peek) {
+		if (nla_get_u32(sinfo[NL80211_SURVEY_INFO_FREQUENCY]) == req->freq)
+			parse_survey_sample(sinfo, req->peek);
+		return NL_SKIP;
+	}
+
+	/* Other channels only get their snapshots brought up to date */
+	if (req->in_use) {
+		add_survey(req->ctx, sinfo, ifidx,
+			   sinfo[NL80211_SURVEY_INFO_IN_USE] ?
+			   (int) nla_get_u32(sinfo[NL80211_SURVEY_INFO_FREQUENCY]) : -1);
+		return NL_SKIP;
+	}
+
+	add_survey(req->ctx, sinfo, ifidx, req->freq);
 
 	return NL_SKIP;
 }
@@ -264,102 +377,234 @@ static __u64 min(__u64 a, __u64 b)
 /*
  * Make it fit in the used data type, this is done
  * so that we always have sane values, otherwise the
- * values will go out of bounds. We pick 2^30 as that
- * 2^31 yields -inf on long double -- and we can add
+ * values will go out of bounds. We default to 2^30 as
+ * that 2^31 yields -inf on long double -- and we can add
  * log(2^30) + log(2^30) in a long double as well.
  */
-static __u64 log2_sane(__u64 val)
+static __u64 log2_sane(__u64 val, __u64 clamp)
 {
-	return log2(min(1073741824, val));
+	/* A quiet dwell has no busy time, log2(0) would be -inf */
+	if (!val)
+		val = 1;
+	return log2(min(clamp, val));
 }
 
-static long double compute_interference_factor(struct freq_survey *survey, __s8 min_noise)
+void acs_params_init(struct acs_params *params)
 {
-	long double factor;
+	params->log2_clamp = 1073741824;
+	params->noise_coeff = 1;
+	params->rank_quantile = 0;
+	params->dwell = 60;
+	params->rounds = 10;
+	params->adaptive = false;
+	params->min_dwell = DWELL_MIN_DEFAULT;
+	params->max_dwell = 0;
+	params->confidence = 0;
+	params->snapshots = 1;
+	params->duty_cycle = 0;
+	params->duty_window = 1000;
+	params->traffic_aware = false;
+	params->budget = 0;
+	params->in_use_hz = 0;
+	params->fresh_ttl = 0;
+}
 
-	factor = log2_sane(survey->channel_time_busy - survey->channel_time_tx);
-	factor -= log2_sane(survey->channel_time - survey->channel_time_tx);
-	factor += survey->noise - min_noise;
+/* Parses "mean" or "pNN" as taken by --rank */
+int acs_parse_rank(const char *str, long double *rank_quantile)
+{
+	int pct;
 
-	survey->interference_factor = factor;
+	if (strcmp(str, "mean") == 0) {
+		*rank_quantile = 0;
+		return 0;
+	}
+
+	if (str[0] != 'p')
+		return -EINVAL;
+	pct = atoi(str + 1);
+	if (pct <= 0 || pct >= 100)
+		return -EINVAL;
+	*rank_quantile = pct / 100.0L;
+
+	return 0;
+}
+
+long double interference_factor(const struct acs_params *params,
+				const struct survey_sample *sample,
+				__s8 min_noise)
+{
+	long double factor;
+
+	if (sample->channel_time_busy > sample->channel_time_tx)
+		factor = log2_sane(sample->channel_time_busy - sample->channel_time_tx,
+				   params->log2_clamp);
+	else
+		factor = 0;
+	factor -= log2_sane(sample->channel_time - sample->channel_time_tx,
+			    params->log2_clamp);
+	factor += params->noise_coeff * (sample->noise - min_noise);
 
 	return factor;
 }
 
+static long double compute_interference_factor(struct acs_ctx *ctx,
+					       struct freq_survey *survey,
+					       __s8 min_noise)
+{
+	struct survey_sample sample = {
+		.noise = survey->noise,
+		.channel_time = survey->channel_time,
+		.channel_time_busy = survey->channel_time_busy,
+		.channel_time_tx = survey->channel_time_tx,
+	};
+
+	survey->interference_factor = interference_factor(&ctx->params, &sample,
+							  min_noise);
+
+	return survey->interference_factor;
+}
+
 #ifdef VERBOSE
-static void parse_survey(struct freq_survey *survey, unsigned int id)
+static void parse_survey(FILE *fp, struct freq_survey *survey, unsigned int id)
 {
 	char dev[20];
 
 	if_indextoname(survey->ifidx, dev);
 
-	if (id == 1)
-		printf("\n");
-
-	printf("Survey %d from %s:\n", id, dev);
-
-	printf("\tnoise:\t\t\t\t%d dBm\n",
-	       (int8_t) survey->noise);
-	printf("\tchannel active time:\t\t%llu ms\n",
-	       (unsigned long long) survey->channel_time);
-	printf("\tchannel busy time:\t\t%llu ms\n",
-	       (unsigned long long) survey->channel_time_busy);
-	printf("\tchannel receive time:\t\t%llu ms\n",
-	       (unsigned long long) survey->channel_time_rx);
-	printf("\tchannel transmit time:\t\t%llu ms\n",
-	       (unsigned long long) survey->channel_time_tx);
-	printf("\tinterference factor:\t\t%Lf\n", survey->interference_factor);
+	fprintf(fp, "\nSurvey %d from %s:\n", id, dev);
+
+	fprintf(fp, "\tnoise:\t\t\t\t%d dBm\n",
+		(int8_t) survey->noise);
+	fprintf(fp, "\tchannel active time:\t\t%llu ms\n",
+		(unsigned long long) survey->channel_time);
+	fprintf(fp, "\tchannel busy time:\t\t%llu ms\n",
+		(unsigned long long) survey->channel_time_busy);
+	fprintf(fp, "\tchannel receive time:\t\t%llu ms\n",
+		(unsigned long long) survey->channel_time_rx);
+	fprintf(fp, "\tchannel transmit time:\t\t%llu ms\n",
+		(unsigned long long) survey->channel_time_tx);
+	fprintf(fp, "\tinterference factor:\t\t%Lf", survey->interference_factor);
 }
 #else
-static void parse_survey(struct freq_survey *survey, unsigned int id)
+static void parse_survey(FILE *fp, struct freq_survey *survey, unsigned int id)
 {
-	printf("%Lf ", survey->interference_factor);
+	fprintf(fp, "%Lf ", survey->interference_factor);
 }
 #endif
 
-static void parse_freq(struct freq_item *freq)
+/*
+ * The interference factor a channel would have at quantile @q of both its
+ * busy ratio and its noise floor, so a single burst does not skew it the
+ * way it does the mean.
+ */
+static long double quantile_factor(struct acs_ctx *ctx, struct freq_item *freq,
+				   long double q, __s8 min_noise)
 {
-	struct freq_survey *survey;
-	unsigned int i = 0;
-	long double int_factor = 0, sum = 0;
+	long double busy, noise;
 
-	if (dl_list_empty(&freq->survey_list) || !freq->enabled)
-		return;
+	busy = sketch_quantile(&freq->busy_sketch, q);
+	if (busy * ctx->params.log2_clamp < 1)
+		busy = 1.0L / ctx->params.log2_clamp;
+	noise = sketch_quantile(&freq->noise_sketch, q);
 
-	printf("%5d surveys for %d MHz: ", freq->survey_count, freq->center_freq);
+	return log2l(busy) + ctx->params.noise_coeff * (noise - min_noise);
+}
+
+/*
+ * What @freq is ranked by while surveying, lower is better: the mean
+ * interference factor of its dwells or, with --rank pNN, its quantile
+ * factor, both against a 0 dBm noise floor so they never need the lowest
+ * noise floor of the survey. Channels come out in the same order as from
+ * score_freq_list().
+ */
+long double freq_rank_factor(struct acs_ctx *ctx, struct freq_item *freq)
+{
+	if (ctx->params.rank_quantile)
+		return quantile_factor(ctx, freq, ctx->params.rank_quantile, 0);
+	return freq->live_stats.mean;
+}
+
+static void score_freq(struct acs_ctx *ctx, struct freq_item *freq)
+{
+	struct freq_survey *survey;
+	long double int_factor;
+
+	chan_stats_init(&freq->stats);
 
 	dl_list_for_each(survey, &freq->survey_list, struct freq_survey, list_member) {
-		int_factor = compute_interference_factor(survey, lowest_noise);
-		sum = freq->interference_factor + int_factor;
-		freq->interference_factor = sum;
-		parse_survey(survey, ++i);
+		int_factor = compute_interference_factor(ctx, survey, ctx->lowest_noise);
+		chan_stats_add(&freq->stats, int_factor, survey->timestamp);
 	}
 
-	freq->interference_factor = freq->interference_factor / freq->survey_count;
-
-	printf("\n");
+	if (ctx->params.rank_quantile)
+		freq->interference_factor = quantile_factor(ctx, freq,
+							    ctx->params.rank_quantile,
+							    ctx->lowest_noise);
+	else
+		freq->interference_factor = freq->stats.mean;
 }
 
 /* At this point its assumed we have the min_noise */
-void parse_freq_list(void)
+void score_freq_list(struct acs_ctx *ctx)
 {
 	struct freq_item *freq;
 
-	dl_list_for_each(freq, &freq_list, struct freq_item, list_member) {
-		parse_freq(freq);
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (dl_list_empty(&freq->survey_list) || !freq->enabled)
+			continue;
+		score_freq(ctx, freq);
 	}
 }
 
-void parse_freq_int_factor(void)
+static void parse_freq(struct acs_ctx *ctx, struct freq_item *freq)
+{
+	struct freq_survey *survey;
+	unsigned int i = 0;
+	char *line = NULL;
+	size_t len;
+	FILE *fp;
+
+	if (dl_list_empty(&freq->survey_list) || !freq->enabled)
+		return;
+
+	score_freq(ctx, freq);
+
+	/* One message per channel however many surveys it has */
+	fp = open_memstream(&line, &len);
+	if (!fp)
+		return;
+	dl_list_for_each(survey, &freq->survey_list, struct freq_survey, list_member)
+		parse_survey(fp, survey, ++i);
+	fclose(fp);
+
+	acs_log(&ctx->log, LOG_INFO, "%5d surveys for %d MHz: %s",
+		freq->survey_count, freq->center_freq, line);
+	acs_log(&ctx->log, LOG_INFO,
+		"\tbusy ratio p50: %Lf p95: %Lf, noise p50: %Lf p95: %Lf dBm",
+		sketch_quantile(&freq->busy_sketch, 0.5),
+		sketch_quantile(&freq->busy_sketch, 0.95),
+		sketch_quantile(&freq->noise_sketch, 0.5),
+		sketch_quantile(&freq->noise_sketch, 0.95));
+	free(line);
+}
+
+void parse_freq_list(struct acs_ctx *ctx)
+{
+	struct freq_item *freq;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		parse_freq(ctx, freq);
+	}
+}
+
+/* Expects the frequencies to have been scored already */
+struct freq_item *get_ideal_freq(struct acs_ctx *ctx)
 {
 	struct freq_item *freq, *ideal_freq = NULL;
 
-	dl_list_for_each(freq, &freq_list, struct freq_item, list_member) {
-		if (dl_list_empty(&freq->survey_list) || !freq->enabled) {
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (dl_list_empty(&freq->survey_list) || !freq->enabled)
 			continue;
-		}
-
-		printf("%d MHz: %Lf\n", freq->center_freq, freq->interference_factor);
 
 		if (!ideal_freq)
 			ideal_freq = freq;
@@ -368,17 +613,57 @@ void parse_freq_int_factor(void)
 				ideal_freq = freq;
 		}
 	}
+
+	return ideal_freq;
+}
+
+void parse_freq_int_factor(struct acs_ctx *ctx)
+{
+	struct freq_item *freq, *ideal_freq;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (dl_list_empty(&freq->survey_list) || !freq->enabled) {
+			continue;
+		}
+
+		acs_log(&ctx->log, LOG_INFO, "%d MHz: %Lf", freq->center_freq,
+			freq->interference_factor);
+	}
+
+	ideal_freq = get_ideal_freq(ctx);
 	if (ideal_freq)
-		printf("Ideal freq: %d MHz\n", ideal_freq->center_freq);
+		acs_log(&ctx->log, LOG_INFO, "Ideal freq: %d MHz",
+			ideal_freq->center_freq);
 	else
-		fprintf(stderr, "invalid ideal freq! list empty.\n");
+		acs_log(&ctx->log, LOG_ERR, "invalid ideal freq! list empty.");
 }
 
-void annotate_enabled_chans(void)
+/* Number of enabled channels surveyed for less than @min_time ms in all */
+unsigned int count_thin_freqs(struct acs_ctx *ctx, __u64 min_time)
 {
+	struct freq_survey *survey;
 	struct freq_item *freq;
+	unsigned int thin = 0;
+	__u64 time;
 
-	dl_list_for_each(freq, &freq_list, struct freq_item, list_member)
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (!freq->enabled)
+			continue;
+		time = 0;
+		dl_list_for_each(survey, &freq->survey_list, struct freq_survey, list_member)
+			time += survey->channel_time;
+		if (time < min_time)
+			thin++;
+	}
+
+	return thin;
+}
+
+void annotate_enabled_chans(struct acs_ctx *ctx)
+{
+	struct freq_item *freq;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member)
 		if (!dl_list_empty(&freq->survey_list))
 			freq->enabled = true;
 }
@@ -392,13 +677,19 @@ static void clean_freq_survey(struct freq_item *freq)
 		freq->survey_count--;
 		free(survey);
 	}
+
+	sketch_reset(&freq->busy_sketch);
+	sketch_reset(&freq->noise_sketch);
+	chan_stats_init(&freq->busy_stats);
+	chan_stats_init(&freq->live_stats);
+	freq->dominated = false;
 }
 
-static void __clean_freq_list(bool clear_freqs)
+static void __clean_freq_list(struct acs_ctx *ctx, bool clear_freqs)
 {
 	struct freq_item *freq, *tmp;
 
-	dl_list_for_each_safe(freq, tmp, &freq_list, struct freq_item, list_member) {
+	dl_list_for_each_safe(freq, tmp, &ctx->freq_list, struct freq_item, list_member) {
 		if (clear_freqs)
 			dl_list_del(&freq->list_member);
 		clean_freq_survey(freq);
@@ -407,12 +698,133 @@ static void __clean_freq_list(bool clear_freqs)
 	}
 }
 
-void clean_freq_list(void)
+void clean_freq_list(struct acs_ctx *ctx)
+{
+	__clean_freq_list(ctx, true);
+}
+
+void clear_freq_surveys(struct acs_ctx *ctx)
 {
-	__clean_freq_list(true);
+	__clean_freq_list(ctx, false);
 }
 
-void clear_freq_surveys(void)
+/* Drops the oldest samples of @freq until @keep are left */
+static void trim_freq_count(struct freq_item *freq, unsigned int keep)
 {
-	__clean_freq_list(false);
+	struct freq_survey *survey, *tmp;
+
+	dl_list_for_each_safe(survey, tmp, &freq->survey_list,
+			      struct freq_survey, list_member) {
+		if (freq->survey_count <= keep)
+			break;
+		dl_list_del(&survey->list_member);
+		freq->survey_count--;
+		free(survey);
+	}
+}
+
+/* Drops the samples of @freq taken before @since */
+static void trim_freq_age(struct freq_item *freq, __u64 since)
+{
+	struct freq_survey *survey, *tmp;
+
+	dl_list_for_each_safe(survey, tmp, &freq->survey_list,
+			      struct freq_survey, list_member) {
+		if (survey->timestamp >= since)
+			break;
+		dl_list_del(&survey->list_member);
+		freq->survey_count--;
+		free(survey);
+	}
+}
+
+/* Whether @freq is sampled in place by the in use sampler */
+static bool freq_sampled_in_use(struct acs_ctx *ctx, struct freq_item *freq)
+{
+	return freq->in_use && ctx->params.in_use_hz;
+}
+
+/*
+ * Drops all but the @keep most recent samples of every channel and
+ * rebuilds the statistics from the ones left, for statistics that follow
+ * the channels as they change rather than average over all time.
+ *
+ * The operating channel sampled with in_use_hz gets many samples for
+ * every one of the other channels, so it is trimmed by age instead: it
+ * keeps the samples taken since the oldest sample any other channel
+ * kept, covering the same rounds as they do.
+ */
+void trim_freq_surveys(struct acs_ctx *ctx, unsigned int keep)
+{
+	struct freq_survey *survey;
+	struct survey_sample sample;
+	struct freq_item *freq;
+	__u64 since = 0;
+	bool others = false;
+
+	ctx->lowest_noise = 100;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (freq_sampled_in_use(ctx, freq))
+			continue;
+		trim_freq_count(freq, keep);
+		if (dl_list_empty(&freq->survey_list))
+			continue;
+		survey = dl_list_first(&freq->survey_list, struct freq_survey,
+				       list_member);
+		if (!others || survey->timestamp < since)
+			since = survey->timestamp;
+		others = true;
+	}
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		if (!freq_sampled_in_use(ctx, freq))
+			continue;
+		if (others)
+			trim_freq_age(freq, since);
+		else
+			trim_freq_count(freq, keep);
+	}
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		freq->max_noise = -128;
+		freq->min_noise = 127;
+		sketch_reset(&freq->busy_sketch);
+		sketch_reset(&freq->noise_sketch);
+		chan_stats_init(&freq->busy_stats);
+		chan_stats_init(&freq->live_stats);
+		freq->dominated = false;
+
+		dl_list_for_each(survey, &freq->survey_list, struct freq_survey, list_member) {
+			sample.timestamp = survey->timestamp;
+			sample.center_freq = survey->center_freq;
+			sample.noise = survey->noise;
+			sample.channel_time = survey->channel_time;
+			sample.channel_time_busy = survey->channel_time_busy;
+			sample.channel_time_rx = survey->channel_time_rx;
+			sample.channel_time_tx = survey->channel_time_tx;
+			account_sample(ctx, freq, &sample);
+		}
+	}
+}
+
+/* Appends every sample kept of every channel to @rec */
+void record_freq_surveys(struct acs_ctx *ctx, struct sample_record *rec)
+{
+	struct freq_survey *survey;
+	struct survey_sample sample;
+	struct freq_item *freq;
+
+	dl_list_for_each(freq, &ctx->freq_list, struct freq_item, list_member) {
+		dl_list_for_each(survey, &freq->survey_list, struct freq_survey, list_member) {
+			sample.timestamp = survey->timestamp;
+			sample.center_freq = survey->center_freq;
+			sample.noise = survey->noise;
+			sample.channel_time = survey->channel_time;
+			sample.channel_time_busy = survey->channel_time_busy;
+			sample.channel_time_rx = survey->channel_time_rx;
+			sample.channel_time_tx = survey->channel_time_tx;
+			record_sample(rec, &sample);
+		}
+	}
 }
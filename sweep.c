@@ -0,0 +1,433 @@
+/*
+ * Parameter sweeps of the scoring model over recorded samples
+ *
+ * acs sweep decodes a corpus of sample records once and then scores it
+ * for every point of a grid of scoring and sampling parameters, one grid
+ * point per task on the work-stealing pool. Each point is judged by how
+ * well its ranking agrees with a ground truth held out from the samples
+ * it scores: the first half of the samples of every channel is scored,
+ * the busy ratio of the second half added up, which is what a single
+ * long dwell would have observed, is the truth.
+ *
+ * That truth knows nothing of the noise floor, a sweep over the noise
+ * coefficient would only ever favour leaving it out, so the coefficient
+ * is not swept and keeps its default.
+ *
+ * Longer dwells are emulated by adding up the counters of consecutive
+ * samples of a channel, so the dwells swept should be multiples of the
+ * dwell the records were taken with.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acs.h"
+
+#define SWEEP_MAX_VALUES	32
+
+struct sweep_chan {
+	__u16 freq;
+	unsigned int nr_samples;
+	unsigned int nr_scored;
+	struct survey_sample *samples;
+	long double truth;
+};
+
+struct sweep_record {
+	unsigned int dwell;
+	unsigned int nr_chans;
+	struct sweep_chan *chans;
+	int err;
+};
+
+struct sweep_point {
+	struct acs_params params;
+	unsigned int records;
+	double top1;
+	double agreement;
+	double airtime;
+};
+
+struct sweep_job {
+	char **paths;
+	unsigned int nr_records;
+	struct sweep_record *records;
+	unsigned int nr_points;
+	struct sweep_point *points;
+};
+
+static void sweep_usage(void)
+{
+	printf("Usage:\tacs sweep [options] <record> ...\n");
+	printf("Options:\n");
+	printf("\t--jobs <n>\t\tnumber of worker threads, defaults to the number of CPUs\n");
+	printf("\t--log2-clamp <list>\tclamp values to sweep, default 1073741824\n");
+	printf("\t--dwell <list>\t\tdwell times in ms to sweep, default 60,120,240\n");
+	printf("\t--rounds <list>\t\tnumber of rounds to sweep, default 1,2,5,10\n");
+	printf("\t--top <n>\t\tnumber of parameter sets to print, default 10\n");
+	printf("Lists are comma separated.\n");
+}
+
+static int sweep_add_sample(const struct survey_sample *sample, void *arg)
+{
+	struct sweep_record *rec = arg;
+	struct survey_sample *samples;
+	struct sweep_chan *chan = NULL, *chans;
+	unsigned int i;
+
+	for (i = 0; i < rec->nr_chans; i++) {
+		if (rec->chans[i].freq == sample->center_freq) {
+			chan = &rec->chans[i];
+			break;
+		}
+	}
+
+	if (!chan) {
+		chans = realloc(rec->chans, (rec->nr_chans + 1) * sizeof(*chans));
+		if (!chans)
+			return -ENOMEM;
+		rec->chans = chans;
+		chan = &rec->chans[rec->nr_chans++];
+		memset(chan, 0, sizeof(*chan));
+		chan->freq = sample->center_freq;
+	}
+
+	samples = realloc(chan->samples, (chan->nr_samples + 1) * sizeof(*samples));
+	if (!samples)
+		return -ENOMEM;
+	chan->samples = samples;
+	chan->samples[chan->nr_samples++] = *sample;
+
+	return 0;
+}
+
+/*
+ * The ground truth is the busy ratio over the second half of the record,
+ * only the first half is scored.
+ */
+static void sweep_set_truth(struct sweep_chan *chan)
+{
+	__u64 time = 0, busy = 0, tx = 0;
+	unsigned int i;
+
+	chan->nr_scored = chan->nr_samples / 2;
+	for (i = chan->nr_scored; i < chan->nr_samples; i++) {
+		time += chan->samples[i].channel_time;
+		busy += chan->samples[i].channel_time_busy;
+		tx += chan->samples[i].channel_time_tx;
+	}
+
+	if (time > tx)
+		chan->truth = (long double) (busy - tx) / (time - tx);
+	else
+		chan->truth = 1;
+}
+
+static void sweep_load(unsigned int task, void *arg)
+{
+	struct sweep_job *job = arg;
+	struct sweep_record *rec = &job->records[task];
+	unsigned int i;
+	int err;
+
+	rec->dwell = 60;
+	err = record_for_each(job->paths[task], 0, 0, &rec->dwell,
+			      sweep_add_sample, rec);
+	if (err < 0) {
+		rec->err = err;
+		return;
+	}
+
+	if (!rec->dwell)
+		rec->dwell = 1;
+
+	for (i = 0; i < rec->nr_chans; i++)
+		sweep_set_truth(&rec->chans[i]);
+}
+
+/*
+ * Scores one record with the parameters of @point. Returns false if the
+ * record does not hold enough samples to emulate the requested dwell
+ * and rounds on every channel. Records are shared by every grid point
+ * scored in parallel, so they are only ever read here.
+ */
+static bool sweep_score(struct sweep_point *point, const struct sweep_record *rec,
+			double *agreement, bool *top1, double *airtime)
+{
+	const struct acs_params *params = &point->params;
+	struct survey_sample dwell;
+	const struct sweep_chan *chan;
+	long double *score;
+	unsigned int i, j, r, k, group, best = 0, truth_best = 0;
+	__s8 min_noise = 100;
+	long concordant = 0, discordant = 0, score_ties = 0, truth_ties = 0;
+	long double norm;
+	int noise;
+
+	group = (params->dwell + rec->dwell / 2) / rec->dwell;
+	if (!group)
+		group = 1;
+
+	for (i = 0; i < rec->nr_chans; i++) {
+		chan = &rec->chans[i];
+		if (chan->nr_scored < group * params->rounds)
+			return false;
+		for (j = 0; j < group * params->rounds; j++)
+			if (chan->samples[j].noise < min_noise)
+				min_noise = chan->samples[j].noise;
+	}
+
+	score = calloc(rec->nr_chans, sizeof(*score));
+	if (!score)
+		return false;
+
+	for (i = 0; i < rec->nr_chans; i++) {
+		chan = &rec->chans[i];
+		for (r = 0; r < params->rounds; r++) {
+			memset(&dwell, 0, sizeof(dwell));
+			noise = 0;
+			for (k = 0; k < group; k++) {
+				j = r * group + k;
+				dwell.channel_time += chan->samples[j].channel_time;
+				dwell.channel_time_busy += chan->samples[j].channel_time_busy;
+				dwell.channel_time_tx += chan->samples[j].channel_time_tx;
+				noise += chan->samples[j].noise;
+			}
+			dwell.noise = noise / (int) group;
+			score[i] += interference_factor(params, &dwell, min_noise);
+		}
+		score[i] /= params->rounds;
+
+		if (score[i] < score[best])
+			best = i;
+		if (chan->truth < rec->chans[truth_best].truth)
+			truth_best = i;
+	}
+
+	/*
+	 * Kendall's tau-b between the scored and the true ranking. Scores
+	 * are coarsely quantized, a pair tied on one side only is no wrong
+	 * order, it just shrinks the normalization.
+	 */
+	for (i = 0; i < rec->nr_chans; i++) {
+		for (j = i + 1; j < rec->nr_chans; j++) {
+			long double ds = score[i] - score[j];
+			long double dt = rec->chans[i].truth - rec->chans[j].truth;
+
+			if (ds == 0 && dt == 0)
+				continue;
+			if (ds == 0)
+				score_ties++;
+			else if (dt == 0)
+				truth_ties++;
+			else if ((ds < 0) == (dt < 0))
+				concordant++;
+			else
+				discordant++;
+		}
+	}
+
+	free(score);
+
+	norm = sqrtl((long double) (concordant + discordant + score_ties) *
+		     (concordant + discordant + truth_ties));
+	if (norm > 0)
+		*agreement = (concordant - discordant) / norm;
+	else
+		*agreement = score_ties || truth_ties ? 0 : 1;
+	*top1 = best == truth_best;
+	*airtime = (double) rec->dwell * group * params->rounds * rec->nr_chans;
+
+	return true;
+}
+
+static void sweep_eval(unsigned int task, void *arg)
+{
+	struct sweep_job *job = arg;
+	struct sweep_point *point = &job->points[task];
+	double agreement, airtime;
+	unsigned int i;
+	bool top1;
+
+	for (i = 0; i < job->nr_records; i++) {
+		if (job->records[i].err || !job->records[i].nr_chans)
+			continue;
+		if (!sweep_score(point, &job->records[i], &agreement, &top1, &airtime))
+			continue;
+		point->records++;
+		point->agreement += agreement;
+		point->top1 += top1;
+		point->airtime += airtime;
+	}
+
+	if (point->records) {
+		point->agreement /= point->records;
+		point->top1 /= point->records;
+		point->airtime /= point->records;
+	}
+}
+
+/* Best agreement first, cheaper sampling first among equals */
+static int sweep_point_cmp(const void *a, const void *b)
+{
+	const struct sweep_point *pa = a, *pb = b;
+
+	if (!pa->records != !pb->records)
+		return pa->records ? -1 : 1;
+	if (pa->top1 != pb->top1)
+		return pa->top1 > pb->top1 ? -1 : 1;
+	if (pa->agreement != pb->agreement)
+		return pa->agreement > pb->agreement ? -1 : 1;
+	if (pa->airtime != pb->airtime)
+		return pa->airtime < pb->airtime ? -1 : 1;
+	return 0;
+}
+
+static int parse_list(const char *str, long double *values)
+{
+	char *end;
+	int n = 0;
+
+	while (*str && n < SWEEP_MAX_VALUES) {
+		values[n++] = strtold(str, &end);
+		if (end == str)
+			return -EINVAL;
+		if (*end == ',')
+			end++;
+		str = end;
+	}
+
+	return n;
+}
+
+int sweep_main(int argc, char **argv)
+{
+	static const long double default_clamps[] = { 1073741824 };
+	static const long double default_dwells[] = { 60, 120, 240 };
+	static const long double default_rounds[] = { 1, 2, 5, 10 };
+	long double clamps[SWEEP_MAX_VALUES];
+	long double dwells[SWEEP_MAX_VALUES], rounds[SWEEP_MAX_VALUES];
+	int nr_clamps = -1, nr_dwells = -1, nr_rounds = -1;
+	unsigned int jobs = 0, top = 10, i, a, c, d;
+	struct sweep_point *point;
+	struct sweep_job job;
+	int err = 0;
+
+	memset(&job, 0, sizeof(job));
+
+	while (argc > 0 && strncmp(*argv, "--", 2) == 0) {
+		if (argc < 2) {
+			sweep_usage();
+			return 1;
+		}
+		if (strcmp(*argv, "--jobs") == 0)
+			jobs = strtoul(argv[1], NULL, 0);
+		else if (strcmp(*argv, "--top") == 0)
+			top = strtoul(argv[1], NULL, 0);
+		else if (strcmp(*argv, "--log2-clamp") == 0)
+			nr_clamps = parse_list(argv[1], clamps);
+		else if (strcmp(*argv, "--dwell") == 0)
+			nr_dwells = parse_list(argv[1], dwells);
+		else if (strcmp(*argv, "--rounds") == 0)
+			nr_rounds = parse_list(argv[1], rounds);
+		else {
+			sweep_usage();
+			return 1;
+		}
+		if (!nr_clamps || !nr_dwells || !nr_rounds ||
+		    nr_clamps < -1 || nr_dwells < -1 || nr_rounds < -1) {
+			fprintf(stderr, "invalid list: %s\n", argv[1]);
+			return 1;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc <= 0) {
+		sweep_usage();
+		return 1;
+	}
+
+	if (nr_clamps < 0) {
+		nr_clamps = ARRAY_SIZE(default_clamps);
+		memcpy(clamps, default_clamps, sizeof(default_clamps));
+	}
+	if (nr_dwells < 0) {
+		nr_dwells = ARRAY_SIZE(default_dwells);
+		memcpy(dwells, default_dwells, sizeof(default_dwells));
+	}
+	if (nr_rounds < 0) {
+		nr_rounds = ARRAY_SIZE(default_rounds);
+		memcpy(rounds, default_rounds, sizeof(default_rounds));
+	}
+
+	job.paths = argv;
+	job.nr_records = argc;
+	job.records = calloc(job.nr_records, sizeof(struct sweep_record));
+	job.nr_points = nr_clamps * nr_dwells * nr_rounds;
+	job.points = calloc(job.nr_points, sizeof(struct sweep_point));
+	if (!job.records || !job.points) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	err = pool_run(job.nr_records, jobs, sweep_load, &job);
+	if (err)
+		goto out;
+
+	for (i = 0; i < job.nr_records; i++) {
+		if (job.records[i].err)
+			fprintf(stderr, "%s: skipped: %s\n", job.paths[i],
+				strerror(-job.records[i].err));
+	}
+
+	point = job.points;
+	for (a = 0; a < nr_clamps; a++)
+		for (c = 0; c < nr_dwells; c++)
+			for (d = 0; d < nr_rounds; d++, point++) {
+				acs_params_init(&point->params);
+				point->params.log2_clamp = clamps[a];
+				point->params.dwell = dwells[c];
+				point->params.rounds = rounds[d];
+				if (!point->params.rounds)
+					point->params.rounds = 1;
+			}
+
+	err = pool_run(job.nr_points, jobs, sweep_eval, &job);
+	if (err)
+		goto out;
+
+	qsort(job.points, job.nr_points, sizeof(struct sweep_point),
+	      sweep_point_cmp);
+
+	printf("%12s %6s %6s %7s %6s %9s %7s\n",
+	       "log2-clamp", "dwell", "rounds",
+	       "top1", "tau", "airtime", "records");
+	for (i = 0; i < job.nr_points && i < top; i++) {
+		point = &job.points[i];
+		if (!point->records)
+			break;
+		printf("%12llu %6u %6u %6.1f%% %6.3f %7.0fms %7u\n",
+		       (unsigned long long) point->params.log2_clamp,
+		       point->params.dwell,
+		       point->params.rounds,
+		       point->top1 * 100,
+		       point->agreement,
+		       point->airtime,
+		       point->records);
+	}
+ out:
+	if (job.records) {
+		for (i = 0; i < job.nr_records; i++) {
+			for (a = 0; a < job.records[i].nr_chans; a++)
+				free(job.records[i].chans[a].samples);
+			free(job.records[i].chans);
+		}
+	}
+	free(job.records);
+	free(job.points);
+	return err;
+}
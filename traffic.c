@@ -0,0 +1,189 @@
+/*
+ * Traffic aware off channel scheduling
+ *
+ * Every dwell takes the radio away from the clients of the AP. Two things
+ * keep that from hurting them:
+ *
+ *	- an airtime duty cycle cap: the time spent off channel within any
+ *	  --duty-window ms never exceeds --duty-cycle percent of it, dwells
+ *	  are held back until that holds and shrunk if they never could.
+ *	- idle gap placement: with --traffic-aware the byte counters of all
+ *	  associated stations are polled before each dwell and the dwell is
+ *	  only started once they stop moving, or after waiting for that for
+ *	  TRAFFIC_MAX_WAIT ms.
+ *
+ * The time spent off channel is accounted either way and reported at the
+ * end of the survey.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "acs.h"
+
+/*
+ * The ledger starts with room for as many dwells of @min_dwell ms as fit
+ * a window, plus the ones partly in it at either end, and grows if
+ * shorter ones come along.
+ */
+int airtime_init(struct airtime *air, long double duty_cycle,
+		 unsigned int window, unsigned int min_dwell)
+{
+	memset(air, 0, sizeof(struct airtime));
+	air->window = window;
+	air->since = monotonic_ms();
+	if (!duty_cycle)
+		return 0;
+
+	air->budget = duty_cycle * window / 100;
+	if (!air->budget)
+		air->budget = 1;
+
+	air->size = window / (min_dwell ? min_dwell : 1) + 2;
+	air->ledger = calloc(air->size, sizeof(struct airtime_span));
+	if (!air->ledger)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void airtime_free(struct airtime *air)
+{
+	free(air->ledger);
+	air->ledger = NULL;
+	air->size = air->nr = 0;
+}
+
+/* Time off channel within [from, to) */
+static __u64 airtime_off(struct airtime *air, __u64 from, __u64 to)
+{
+	__u64 off = 0, start, end;
+	unsigned int i;
+
+	for (i = 0; i < air->nr; i++) {
+		start = air->ledger[i].start > from ? air->ledger[i].start : from;
+		end = air->ledger[i].end < to ? air->ledger[i].end : to;
+		if (end > start)
+			off += end - start;
+	}
+
+	return off;
+}
+
+/*
+ * Shrinks @duration to what fits the duty cycle at all and returns how
+ * long to wait until a dwell that long fits the duty cycle.
+ */
+unsigned int airtime_wait(struct airtime *air, unsigned int *duration)
+{
+	__u64 now = monotonic_ms(), lo = 0, hi = air->window, mid, from;
+
+	if (!air->budget)
+		return 0;
+	if (*duration > air->budget)
+		*duration = air->budget;
+
+	/*
+	 * Nothing else is ever added to the ledger while waiting, so the
+	 * time spent off channel in the window a dwell would end in only
+	 * drops the later the dwell starts.
+	 */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		from = now + mid + *duration;
+		from = from > air->window ? from - air->window : 0;
+		if (airtime_off(air, from, now + mid) + *duration <= air->budget)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+/*
+ * Accounts the radio having been off channel from @start to @end. Only
+ * the intervals the duty cycle can still see are kept, however many
+ * that takes.
+ */
+void airtime_account(struct airtime *air, __u64 start, __u64 end)
+{
+	struct airtime_span *ledger;
+	unsigned int expired = 0;
+
+	if (end <= start)
+		return;
+	air->total += end - start;
+	if (!air->budget)
+		return;
+
+	while (expired < air->nr &&
+	       air->ledger[expired].end + air->window <= end)
+		expired++;
+	air->nr -= expired;
+	memmove(air->ledger, air->ledger + expired,
+		air->nr * sizeof(struct airtime_span));
+
+	if (air->nr == air->size) {
+		ledger = realloc(air->ledger,
+				 2 * air->size * sizeof(struct airtime_span));
+		if (!ledger) {
+			/* Forgetting the oldest beats not accounting at all */
+			air->nr--;
+			memmove(air->ledger, air->ledger + 1,
+				air->nr * sizeof(struct airtime_span));
+		} else {
+			air->ledger = ledger;
+			air->size *= 2;
+		}
+	}
+
+	air->ledger[air->nr].start = start;
+	air->ledger[air->nr].end = end;
+	air->nr++;
+}
+
+void airtime_report(struct airtime *air, const struct acs_logger *log)
+{
+	__u64 elapsed = monotonic_ms() - air->since;
+
+	/* Never went off channel, like a quick survey */
+	if (!air->since || !elapsed)
+		return;
+
+	acs_log(log, LOG_INFO, "off channel for %llu of %llu ms (%.2Lf%%)",
+		(unsigned long long) air->total, (unsigned long long) elapsed,
+		(long double) air->total * 100 / elapsed);
+}
+
+int handle_station_dump(struct nl_msg *msg, void *arg)
+{
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *sinfo[NL80211_STA_INFO_MAX + 1];
+	struct station_traffic *traffic = arg;
+
+	static struct nla_policy stats_policy[NL80211_STA_INFO_MAX + 1] = {
+		[NL80211_STA_INFO_RX_BYTES] = { .type = NLA_U32 },
+		[NL80211_STA_INFO_TX_BYTES] = { .type = NLA_U32 },
+	};
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+
+	if (!tb[NL80211_ATTR_STA_INFO] ||
+	    nla_parse_nested(sinfo, NL80211_STA_INFO_MAX,
+			     tb[NL80211_ATTR_STA_INFO], stats_policy))
+		return NL_SKIP;
+
+	traffic->stations++;
+	/* Summed modulo 2^32, deltas of the sum stay right across wraps */
+	if (sinfo[NL80211_STA_INFO_RX_BYTES])
+		traffic->bytes += nla_get_u32(sinfo[NL80211_STA_INFO_RX_BYTES]);
+	if (sinfo[NL80211_STA_INFO_TX_BYTES])
+		traffic->bytes += nla_get_u32(sinfo[NL80211_STA_INFO_TX_BYTES]);
+
+	return NL_SKIP;
+}